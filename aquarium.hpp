@@ -102,8 +102,6 @@ layout(location = 4) uniform vec3 ambient = vec3(0.005);
 layout(location = 5) uniform float gloss = 4;
 layout(location = 6) uniform float waterAbsorbance = 0.02f;
 layout(location = 7) uniform vec3 waterCol = vec3(0.36, 0.61, 1);
-layout(location = 9) uniform bool usePhong = false;
-layout(location = 10) uniform bool doWaterOcclusion = true;
 in vec3 worldPos;
 in vec3 viewPos;
 
@@ -131,7 +129,7 @@ void main()
     Lighting light;
     light.diffuse = light.specular = vec3(0);
 
-    for(uint i = 0; i < pointLightN; i++)
+    for(uint i = 0; i < LIGHT_COUNT; i++)
     {
         vec3 lPos = vec3(mGLuGlobal.view * vec4(pointLights[i].pos,1));
         vec3 lCol = pointLights[i].col * pointLights[i].intensity;
@@ -142,24 +140,26 @@ void main()
         float fallof = 1/(lDistanceSqr+1);
 
         Lighting newLight;
-        if(usePhong)
-            newLight = CalcPhong(
-                viewDir,
-                lCol * fallof, lDir, ambient,
-                viewNormal, color, spec, gloss);
-        else
-            newLight = CalcLighting(
-                viewDir,
-                lCol * fallof, lDir, ambient,
-                viewNormal, color, spec, gloss);
+#if USE_PHONG
+        newLight = CalcPhong(
+            viewDir,
+            lCol * fallof, lDir, ambient,
+            viewNormal, color, spec, gloss);
+#else
+        newLight = CalcLighting(
+            viewDir,
+            lCol * fallof, lDir, ambient,
+            viewNormal, color, spec, gloss);
+#endif
         light.diffuse += newLight.diffuse;
         light.specular += newLight.specular;
     }
     
     vec3 waterOpacity = BeerLambertOpacity(waterAbsorbance * (vec3(1) - waterCol), length(viewPos));
     ColorAlpha blend = Blend(vec3(1), light.specular, light.diffuse, vec3(1));
-    if(doWaterOcclusion)
-        blend.color = (vec3(1)-waterOpacity)*blend.color;
+#if WATER_OCCLUSION
+    blend.color = (vec3(1)-waterOpacity)*blend.color;
+#endif
     outCol = vec4(blend.color,1);
     outAlpha = vec4(blend.alpha, 1);
 }   
@@ -168,12 +168,14 @@ class Aquarium
 {
     const glm::vec3 min, max;
     mGLu::Drawable box;
+    enum Option : unsigned int { UsePhong, WaterOcclusion, LightCount };
+    mGLu::ShaderVariants shaders;
+    mGLu::ShaderVariants::Key shaderKey = 0;
 public:
-    Aquarium(const mGLu::Window *window, glm::vec3 _min, glm::vec3 _max):
+    Aquarium(const mGLu::Window *window, glm::vec3 _min, glm::vec3 _max, mGLu::BufferArena &meshArena):
         min(_min), max(_max)
     {
-        mGLu::VAO vao;
-        GLuint posBinding = vao.AddAttrib(GL_FLOAT, 3, "inPos");
+        mGLu::VAO vao = mGLu::VAO::FromFormat<mGLu::PositionFormat>(true); // the player model pulls the same format, so no VAO switch between the two
         box.vao = vao;
         glm::vec3 vertices[8] = 
         {
@@ -207,25 +209,37 @@ public:
             7, 3, 2,
             6, 7, 2
         };
-        box.buffers.push_back(mGLu::FixedBuffer(8, vertices));
-        box.indexBuffer = mGLu::FixedBuffer(36, indices);
-        box.SetBinding(posBinding, 0, 0, sizeof(glm::vec3));
-        box.shader = mGLu::Shader(*window, (vao.GetShaderPrefix() + aquariumVScode).c_str(), (std::string(lightBufferPrefixCode) + aquariumFScode).c_str());
+        box.SetBindings<mGLu::PositionFormat, mGLu::PositionLayout>(meshArena.Allocate(8, vertices));
+        box.SetIndexBuffer(meshArena.Allocate(36, indices));
+        shaders = mGLu::ShaderVariants({{"USE_PHONG"}, {"WATER_OCCLUSION", 2, 1}, {"LIGHT_COUNT", maxPointLights + 1, maxPointLights}},
+            [window, vsPrefix = std::string(vao.GetShaderPrefix())](mGLu::ShaderVariants::Key, const std::string &defines){
+                return mGLu::Shader(*window, (defines + vsPrefix + aquariumVScode).c_str(), (defines + lightBufferPrefixCode + aquariumFScode).c_str());
+            });
+        shaderKey = shaders.GetDefaultKey();
     }
-    void Draw()
+    void Submit(mGLu::RenderQueue &queue) // the walls are the background everything else is blended over
     {
-        box.DrawIndexed(36);
+        box.shader = shaders.Get(shaderKey);
+        mGLu::RenderPacket packet;
+        packet.key = mGLu::RenderQueue::MakeKey(mGLu::RenderPass::Background, box);
+        packet.drawable = &box;
+        packet.command = mGLu::RenderQueue::IndexedCommand(box, 36);
+        queue.Submit(std::move(packet));
     }
     void ToggleUsePhong()
     {
-        static bool currState = false;
-        box.shader.Use();
-        glUniform1i(9, currState = !currState);
+        shaderKey = shaders.With(shaderKey, UsePhong, !shaders.GetValue(shaderKey, UsePhong));
     }
     void ToggleDoWaterOcclusion()
     {
-        static bool currState = true;
-        box.shader.Use();
-        glUniform1i(10, currState = !currState);
+        shaderKey = shaders.With(shaderKey, WaterOcclusion, !shaders.GetValue(shaderKey, WaterOcclusion));
+    }
+    void SetLightCount(unsigned int count) // the lights in the light buffer, up to maxPointLights
+    {
+        shaderKey = shaders.With(shaderKey, LightCount, count);
+    }
+    void PrecompileShaders(unsigned int lightCount) // the current variant with this many lights, the debug toggles compile theirs on first use
+    {
+        shaders.Precompile(shaders.With(shaderKey, LightCount, lightCount));
     }
 };
\ No newline at end of file
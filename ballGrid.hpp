@@ -0,0 +1,176 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+// Uniform grid over the aquarium for ball proximity queries. Balls are bucketed by centre into cells
+// at least one maximal ball diameter wide, so a sphere query only has to look at the cells its bounds touch.
+// Ball indices refer to the arrays passed to the last Rebuild() and stay valid until they change.
+class BallGrid
+{
+    glm::vec3 gridMin{0.f};
+    glm::ivec3 dims{1, 1, 1};
+    float cellSize = 1.f, maxBallRadius = 0.f;
+    float slack = 0.f; // how far balls have left their cells since Build(), queries reach that much further
+
+    std::vector<unsigned int> cellStart; // balls of cell c are cellBalls[cellStart[c]] to cellBalls[cellStart[c+1]-1]
+    std::vector<unsigned int> cellBalls;
+    std::vector<unsigned int> ballCell;
+    const float *posX = nullptr, *posY = nullptr, *posZ = nullptr, *scale = nullptr;
+
+    glm::ivec3 CellCoord(float x, float y, float z) const // clamped, balls spawning just outside land in the border cells
+    {
+        return glm::clamp(glm::ivec3(glm::floor((glm::vec3(x, y, z) - gridMin) / cellSize)), glm::ivec3(0), dims - 1);
+    }
+    unsigned int CellIndex(glm::ivec3 coord) const
+    {
+        return (coord.z * dims.y + coord.y) * dims.x + coord.x;
+    }
+    float DistanceSqr(glm::vec3 point, unsigned int ball) const
+    {
+        float dx = posX[ball] - point.x, dy = posY[ball] - point.y, dz = posZ[ball] - point.z;
+        return dx*dx + dy*dy + dz*dz;
+    }
+public:
+    void Resize(glm::vec3 minBounds, glm::vec3 maxBounds, float _maxBallRadius)
+    {
+        maxBallRadius = _maxBallRadius;
+        cellSize = std::max(2.f * maxBallRadius, 1e-3f);
+        gridMin = minBounds;
+        dims = glm::max(glm::ivec3(glm::ceil((maxBounds - minBounds) / cellSize)), glm::ivec3(1));
+        cellStart.assign(dims.x * dims.y * dims.z + 1, 0);
+        cellBalls.clear();
+    }
+    // Rebuilding is split into Prepare(), AssignCells() over every ball (in any number of chunks, from any thread) and Build()
+    void Prepare(const float *_posX, const float *_posY, const float *_posZ, const float *_scale, unsigned int count)
+    {
+        posX = _posX; posY = _posY; posZ = _posZ; scale = _scale;
+        ballCell.resize(count);
+    }
+    void AssignCells(std::size_t begin, std::size_t end)
+    {
+        for(std::size_t i = begin; i < end; i++)
+            ballCell[i] = CellIndex(CellCoord(posX[i], posY[i], posZ[i]));
+    }
+    void Build() // counting sort by cell, O(balls + cells)
+    {
+        std::fill(cellStart.begin(), cellStart.end(), 0);
+        for(unsigned int cell : ballCell)
+            cellStart[cell + 1]++;
+        for(std::size_t c = 1; c < cellStart.size(); c++)
+            cellStart[c] += cellStart[c-1];
+        cellBalls.resize(ballCell.size());
+        for(unsigned int i = 0; i < ballCell.size(); i++)
+            cellBalls[cellStart[ballCell[i]]++] = i;
+        for(std::size_t c = cellStart.size() - 1; c > 0; c--) // the fill pass advanced every start to the next cell's
+            cellStart[c] = cellStart[c-1];
+        cellStart[0] = 0;
+        slack = 0.f;
+    }
+    // Largest distance along an axis that balls [begin, end) have moved outside the cells Build() put them in, for moving
+    // balls a little after building without rebuilding: pass the maximum over all balls to SetSlack()
+    float Drift(std::size_t begin, std::size_t end) const
+    {
+        float drift = 0.f;
+        for(std::size_t i = begin; i < end; i++)
+        {
+            const glm::ivec3 now = CellCoord(posX[i], posY[i], posZ[i]);
+            const glm::ivec3 built(ballCell[i] % dims.x, ballCell[i] / dims.x % dims.y, ballCell[i] / (dims.x * dims.y));
+            const glm::vec3 pos(posX[i], posY[i], posZ[i]);
+            for(int axis = 0; axis < 3; axis++)
+                if(now[axis] != built[axis])
+                {
+                    const float cellMin = gridMin[axis] + built[axis] * cellSize;
+                    drift = std::max({drift, cellMin - pos[axis], pos[axis] - (cellMin + cellSize)});
+                }
+        }
+        return drift;
+    }
+    void SetSlack(float _slack)
+    {
+        slack = _slack;
+    }
+    void Rebuild(const float *_posX, const float *_posY, const float *_posZ, const float *_scale, unsigned int count)
+    {
+        Prepare(_posX, _posY, _posZ, _scale, count);
+        AssignCells(0, count);
+        Build();
+    }
+    void Clear()
+    {
+        std::fill(cellStart.begin(), cellStart.end(), 0);
+        cellBalls.clear();
+    }
+    template<typename Func>
+    void ForEachNearby(glm::vec3 center, float radius, Func func) const // calls func(ball) for every ball whose cell could overlap the sphere
+    {
+        if(cellBalls.empty())
+            return;
+        const float reach = radius + maxBallRadius + slack;
+        const glm::ivec3 lo = CellCoord(center.x - reach, center.y - reach, center.z - reach);
+        const glm::ivec3 hi = CellCoord(center.x + reach, center.y + reach, center.z + reach);
+        for(int z = lo.z; z <= hi.z; z++)
+            for(int y = lo.y; y <= hi.y; y++)
+            {
+                const unsigned int rowStart = CellIndex({lo.x, y, z}), rowEnd = CellIndex({hi.x, y, z}) + 1; // cells of a row are contiguous
+                for(unsigned int i = cellStart[rowStart]; i < cellStart[rowEnd]; i++)
+                    func(cellBalls[i]);
+            }
+    }
+    bool OverlapsSphere(glm::vec3 center, float radius) const
+    {
+        bool hit = false;
+        ForEachNearby(center, radius, [&](unsigned int ball){
+            float reach = radius + scale[ball];
+            hit = hit || DistanceSqr(center, ball) < reach * reach;
+        });
+        return hit;
+    }
+    int Nearest(glm::vec3 point, float *distanceSqr = nullptr) const // index of the ball with the closest centre, -1 if there are none
+    {
+        if(cellBalls.empty())
+            return -1;
+        const glm::ivec3 c = CellCoord(point.x, point.y, point.z);
+        const int maxRing = std::max({c.x, dims.x - 1 - c.x, c.y, dims.y - 1 - c.y, c.z, dims.z - 1 - c.z});
+        int best = -1;
+        float bestDistSqr = INFINITY;
+        auto visitCell = [&](glm::ivec3 coord){
+            const unsigned int cell = CellIndex(coord);
+            for(unsigned int i = cellStart[cell]; i < cellStart[cell + 1]; i++)
+            {
+                float distSqr = DistanceSqr(point, cellBalls[i]);
+                if(distSqr < bestDistSqr)
+                {
+                    bestDistSqr = distSqr;
+                    best = cellBalls[i];
+                }
+            }
+        };
+        for(int ring = 0; ring <= maxRing; ring++) // grows a cube of cells around the point one shell at a time
+        {
+            const glm::ivec3 lo = glm::max(c - ring, glm::ivec3(0)), hi = glm::min(c + ring, dims - 1);
+            for(int z = lo.z; z <= hi.z; z++)
+                for(int y = lo.y; y <= hi.y; y++)
+                {
+                    if(std::abs(z - c.z) == ring || std::abs(y - c.y) == ring)
+                    {
+                        for(int x = lo.x; x <= hi.x; x++)
+                            visitCell({x, y, z});
+                    }
+                    else // rows inside the shell only touch it at their ends
+                    {
+                        if(c.x - ring >= 0)
+                            visitCell({c.x - ring, y, z});
+                        if(c.x + ring < dims.x)
+                            visitCell({c.x + ring, y, z});
+                    }
+                }
+            const float ringDist = std::max(ring * cellSize - slack, 0.f); // every ball in outer rings is at least this far away
+            if(best >= 0 && bestDistSqr <= ringDist * ringDist)
+                break;
+        }
+        if(distanceSqr)
+            *distanceSqr = bestDistSqr;
+        return best;
+    }
+};
@@ -1,7 +1,16 @@
 #pragma once
 #include "random.hpp"
+#include "ballSimulationGPU.hpp"
+#include "oit.hpp"
+#include "ballKernels.hpp"
+#include "ballGrid.hpp"
+#include "ballPhysics.hpp"
 #include <algorithm>
 #include <functional>
+#include <cstdint>
+#include <atomic>
+#include <numeric>
+#include <string_view>
 const char *ballVScode = R"DENOM(
 vec3 CalcOtherP(vec3 bPos, float bRad, vec3 P, vec3 V)
 {
@@ -17,25 +26,146 @@ out vec3 viewNormalB;
 out vec3 viewPos;
 out vec3 viewPosB;
 out vec3 ballCol;
+layout(location = 14) uniform vec3 instanceOrigin = vec3(0); // packed instances are stored relative to it
 void main()
 {
 
     mat3 normalMat = transpose(inverse(mat3(mGLuGlobal.view)));
     viewNormal = normalize(normalMat*inPos);
 
-    viewPos = vec3(mGLuGlobal.view * vec4(inPos*instanceScale + instancePos, 1));
+    const vec3 ballPos = instancePos + instanceOrigin;
+    viewPos = vec3(mGLuGlobal.view * vec4(inPos*instanceScale + ballPos, 1));
 
     gl_Position = mGLuGlobal.projection * vec4(viewPos,1);
     ballCol = instanceCol;
 
     const vec3 camDir = normalize(viewPos);
-    const vec3 ballViewPos = vec3(mGLuGlobal.view * vec4(instancePos,1));
+    const vec3 ballViewPos = vec3(mGLuGlobal.view * vec4(ballPos,1));
     
     viewPosB = CalcOtherP(ballViewPos, instanceScale, viewPos, camDir);
     viewNormalB = -normalize(viewPosB - ballViewPos);
     
 }
 )DENOM";
+const char *ballImpostorVScode = R"DENOM(
+out vec3 quadViewPos;
+flat out vec3 ballViewPos;
+flat out float ballRadius;
+out vec3 ballCol;
+layout(location = 14) uniform vec3 instanceOrigin = vec3(0); // packed instances are stored relative to it
+void main()
+{
+    ballCol = instanceCol;
+    ballRadius = instanceScale;
+    ballViewPos = vec3(mGLuGlobal.view * vec4(instancePos + instanceOrigin, 1));
+    quadViewPos = vec3(0);
+
+    float dist = length(ballViewPos);
+    if(dist <= instanceScale) // camera inside the ball, which the mesh path culls as back faces too
+    {
+        gl_Position = vec4(2, 2, 2, 1);
+        return;
+    }
+    // camera facing quad in the plane touching the front of the ball, just big enough to cover its silhouette there
+    vec3 toBall = ballViewPos / dist;
+    vec3 right = normalize(cross(toBall, abs(toBall.y) < 0.99 ? vec3(0, 1, 0) : vec3(1, 0, 0)));
+    vec3 up = cross(right, toBall);
+    float planeDist = dist - instanceScale;
+    float halfSize = instanceScale * planeDist / sqrt(dist*dist - instanceScale*instanceScale);
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2 - 1;
+    quadViewPos = toBall * planeDist + (right * corner.x + up * corner.y) * halfSize;
+    gl_Position = mGLuGlobal.projection * vec4(quadViewPos, 1);
+}
+)DENOM";
+// Tessellated balls: every instance is the icosahedron as 20 patches, the TCS subdivides each edge by its
+// projected arc length and the TES pushes the new vertices onto the sphere.
+const char *ballTessVScode = R"DENOM(
+out vec3 tcDir;
+out vec3 tcBallPos;
+out float tcScale;
+out vec3 tcCol;
+layout(location = 14) uniform vec3 instanceOrigin = vec3(0); // packed instances are stored relative to it
+void main()
+{
+    tcDir = inPos;
+    tcBallPos = instancePos + instanceOrigin;
+    tcScale = instanceScale;
+    tcCol = instanceCol;
+}
+)DENOM";
+const char *ballTessControlCode = R"DENOM(
+layout(vertices = 3) out;
+in vec3 tcDir[];
+in vec3 tcBallPos[];
+in float tcScale[];
+in vec3 tcCol[];
+out vec3 teDir[];
+patch out vec3 teBallPos;
+patch out float teScale;
+patch out vec3 teCol;
+layout(location = 15) uniform float pixelsPerUnit; // size of one unit at distance 1
+layout(location = 16) uniform float tessEdgePixels = 8;
+float EdgeLevel(vec3 dirA, vec3 dirB) // only depends on the edge, so both patches sharing it agree and no cracks open
+{
+    vec3 mid = tcBallPos[0] + normalize(dirA + dirB) * tcScale[0];
+    float dist = max(length(vec3(mGLuGlobal.view * vec4(mid, 1))), 1e-3);
+    float arcPixels = tcScale[0] * acos(clamp(dot(dirA, dirB), -1, 1)) * pixelsPerUnit / dist;
+    return clamp(arcPixels / tessEdgePixels, 1, 64);
+}
+void main()
+{
+    teDir[gl_InvocationID] = tcDir[gl_InvocationID];
+    if(gl_InvocationID == 0)
+    {
+        teBallPos = tcBallPos[0];
+        teScale = tcScale[0];
+        teCol = tcCol[0];
+        gl_TessLevelOuter[0] = EdgeLevel(tcDir[1], tcDir[2]);
+        gl_TessLevelOuter[1] = EdgeLevel(tcDir[2], tcDir[0]);
+        gl_TessLevelOuter[2] = EdgeLevel(tcDir[0], tcDir[1]);
+        gl_TessLevelInner[0] = max(max(gl_TessLevelOuter[0], gl_TessLevelOuter[1]), gl_TessLevelOuter[2]);
+    }
+}
+)DENOM";
+const char *ballTessEvalCode = R"DENOM(
+layout(triangles, fractional_odd_spacing, ccw) in; // fractional spacing morphs between levels instead of popping
+in vec3 teDir[];
+patch in vec3 teBallPos;
+patch in float teScale;
+patch in vec3 teCol;
+vec3 CalcOtherP(vec3 bPos, float bRad, vec3 P, vec3 V)
+{
+    vec3 cV = bPos - P;
+    vec3 cProj = P + V * dot(V, cV);
+
+    vec3 P_ = 2*cProj - P;
+    
+    return P_;
+}
+out vec3 viewNormal;
+out vec3 viewNormalB;
+out vec3 viewPos;
+out vec3 viewPosB;
+out vec3 ballCol;
+void main()
+{
+    vec3 dir = normalize(gl_TessCoord.x * teDir[0] + gl_TessCoord.y * teDir[1] + gl_TessCoord.z * teDir[2]);
+
+    mat3 normalMat = transpose(inverse(mat3(mGLuGlobal.view)));
+    viewNormal = normalize(normalMat*dir);
+
+    viewPos = vec3(mGLuGlobal.view * vec4(dir*teScale + teBallPos, 1));
+
+    gl_Position = mGLuGlobal.projection * vec4(viewPos,1);
+    ballCol = teCol;
+
+    const vec3 camDir = normalize(viewPos);
+    const vec3 ballViewPos = vec3(mGLuGlobal.view * vec4(teBallPos,1));
+    
+    viewPosB = CalcOtherP(ballViewPos, teScale, viewPos, camDir);
+    viewNormalB = -normalize(viewPosB - ballViewPos);
+}
+)DENOM";
 const char *ballFScode = R"DENOM(
 float BeerLambertOpacity(float a, float d)
 {
@@ -119,14 +249,48 @@ ColorAlpha Blend(vec3 colA, vec3 alphaA, vec3 colB, vec3 alphaB)
 
     return res;
 }
+#ifdef IMPOSTOR
+layout(depth_greater) out float gl_FragDepth; // the ball is always behind the quad, so early depth tests still work
+in vec3 quadViewPos;
+flat in vec3 ballViewPos;
+flat in float ballRadius;
+vec3 viewNormal;
+vec3 viewNormalB;
+vec3 viewPos;
+vec3 viewPosB;
+bool IntersectBall() // exact front and back hit of the view ray through this fragment
+{
+    vec3 dir = normalize(quadViewPos);
+    float b = dot(dir, ballViewPos);
+    float disc = b*b - dot(ballViewPos, ballViewPos) + ballRadius*ballRadius;
+    if(disc < 0)
+        return false;
+    float h = sqrt(disc);
+    viewPos = dir * (b - h);
+    viewPosB = dir * (b + h);
+    viewNormal = (viewPos - ballViewPos) / ballRadius;
+    viewNormalB = (ballViewPos - viewPosB) / ballRadius;
+
+    vec4 clipPos = mGLuGlobal.projection * vec4(viewPos, 1);
+    gl_FragDepth = (gl_DepthRange.diff * clipPos.z / clipPos.w + gl_DepthRange.near + gl_DepthRange.far) * 0.5;
+    return true;
+}
+#else
 in vec3 viewNormal;
 in vec3 viewNormalB;
 in vec3 viewPos;
 in vec3 viewPosB;
+#endif
 in vec3 ballCol;
 
+#if OIT_PASS
+layout(location = 0) out vec4 outAccumColor;
+layout(location = 1) out vec4 outAccumAlpha;
+layout(location = 2) out vec4 outRevealage;
+#else
 out vec4 outCol;
 out vec4 outAlpha;
+#endif
 
 layout(location = 0) uniform vec3 ballSpec = vec3(0.6);
 layout(location = 1) uniform vec3 ambient = vec3(0.005);
@@ -140,23 +304,28 @@ layout(location = 7) uniform vec3 waterSpec = vec3(0.7);
 layout(location = 9) uniform float waterAbsorbance = 0.02f;
 layout(location = 10) uniform float waterGloss = 64;
 
-layout(location = 11) uniform bool transparentBalls = true;
-layout(location = 12) uniform bool usePhong = false;
-layout(location = 13) uniform bool doWaterOcclusion = true;
 void main()
 {   
+#ifdef IMPOSTOR
+    if(!IntersectBall())
+        discard;
+#endif
+#if !OIT_PASS
     outCol = vec4(0);
     outAlpha = vec4(1);
+#endif
 
     vec3 viewDir = normalize(-viewPos);
     
+#if TRANSPARENT_BALLS
+    vec3 diffuseAlpha = vec3(transparentBallDiffuseAlpha);
+#else
     vec3 diffuseAlpha = vec3(1);
-    if(transparentBalls)
-        diffuseAlpha = vec3(transparentBallDiffuseAlpha);
+#endif
     Lighting lightA, lightB;
     lightA.diffuse = lightA.specular = lightB.diffuse = lightB.specular = vec3(0);
 
-    for(int i = 0; i < pointLightN; i++)
+    for(int i = 0; i < LIGHT_COUNT; i++)
     {
     
         vec3 lPos = vec3(mGLuGlobal.view * vec4(pointLights[i].pos,1));
@@ -178,30 +347,27 @@ void main()
 
         Lighting newLightA, newLightB;
 
-        if(usePhong)
-        {
-            newLightA = CalcPhong(
-                viewDir,
-                lCol*fallofA, lDirA, ambient,
-                viewNormal, ballCol, ballSpec, ballGloss);
-
-            newLightB = CalcPhong(
-                viewDir,
-                lightRestB*fallofB, lDirB, ambient,
-                viewNormalB, waterCol, waterSpec, waterGloss);
-        }
-        else
-        {
-            newLightA = CalcLighting(
-                viewDir,
-                lCol*fallofA, lDirA, ambient,
-                viewNormal, ballCol, ballSpec, ballGloss);
-
-            newLightB = CalcLighting(
-                viewDir,
-                lightRestB*fallofB, lDirB, ambient,
-                viewNormalB, waterCol, waterSpec, waterGloss);
-        }
+#if USE_PHONG
+        newLightA = CalcPhong(
+            viewDir,
+            lCol*fallofA, lDirA, ambient,
+            viewNormal, ballCol, ballSpec, ballGloss);
+
+        newLightB = CalcPhong(
+            viewDir,
+            lightRestB*fallofB, lDirB, ambient,
+            viewNormalB, waterCol, waterSpec, waterGloss);
+#else
+        newLightA = CalcLighting(
+            viewDir,
+            lCol*fallofA, lDirA, ambient,
+            viewNormal, ballCol, ballSpec, ballGloss);
+
+        newLightB = CalcLighting(
+            viewDir,
+            lightRestB*fallofB, lDirB, ambient,
+            viewNormalB, waterCol, waterSpec, waterGloss);
+#endif
         
         lightA.diffuse += newLightA.diffuse;
         lightA.specular += newLightA.specular;
@@ -223,20 +389,69 @@ void main()
     
     vec3 waterOpacity = BeerLambertOpacity(waterAbsorbance * (vec3(1) - waterCol), length(viewPos));
 
-    ColorAlpha finalBlend;
-    if(doWaterOcclusion)
-    {
-        finalBlend.color = (vec3(1)-waterOpacity)*blendAB.color;
-        finalBlend.alpha = blendAB.alpha;
-    }
-    else
-        finalBlend = blendAB;
+    ColorAlpha finalBlend = blendAB;
+#if WATER_OCCLUSION
+    finalBlend.color = (vec3(1)-waterOpacity)*blendAB.color;
+#endif
     
+#if OIT_PASS
+    float viewDepth = length(viewPos);
+    float weight = clamp(10. / (1e-5 + pow(viewDepth/5., 2.) + pow(viewDepth/200., 6.)), 1e-2, 3e3);
+    outAccumColor = vec4(finalBlend.color * finalBlend.alpha * weight, 1);
+    outAccumAlpha = vec4(finalBlend.alpha * weight, 1);
+    outRevealage = vec4(finalBlend.alpha, 1); // blended as dst * (1 - src), per channel transmittance
+#else
     outCol = vec4(finalBlend.color,1);
     outAlpha = vec4(finalBlend.alpha,1);
-    
+#endif
 }
 
+)DENOM";
+const char *ballSortKeyCScode = R"DENOM(
+layout(local_size_x = 64) in;
+struct Ball
+{
+    vec3 pos;
+    float scale;
+    float initScale;
+    float colR, colG, colB;
+};
+struct DrawCommand
+{
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+struct KeyValue
+{
+    float key;
+    uint value;
+};
+layout(std430, binding = 2) readonly buffer BALLS
+{
+    Ball balls[];
+};
+layout(std430, binding = 5) readonly buffer DRAW_COMMANDS
+{
+    DrawCommand drawCommands[2];
+};
+layout(std430, binding = 7) writeonly buffer KEY_VALUES
+{
+    KeyValue keyValues[];
+};
+layout(location = 0) uniform vec3 cameraPos;
+layout(location = 1) uniform uint ballCount;
+layout(location = 2) uniform int drawCommandIndex; // >= 0 takes the ball count from the GPU simulation instead of ballCount
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    uint count = drawCommandIndex >= 0 ? drawCommands[drawCommandIndex].instanceCount : ballCount;
+    if(i >= count)
+        return;
+    keyValues[i] = KeyValue(distance(balls[i].pos, cameraPos) - balls[i].scale, i);
+}
 )DENOM";
 
 void GenerateSphere(std::vector<glm::vec3> &posOut, std::vector<unsigned int> &indexOut, unsigned int subdivision = 2)
@@ -270,10 +485,46 @@ void GenerateSphere(std::vector<glm::vec3> &posOut, std::vector<unsigned int> &i
             vert = vert/glm::length(vert);
     }
 }
+// Icospheres from maxSubdivision down to 0 subdivisions sharing one vertex array, the index ranges of the levels are
+// stored finest first in indexOut, lodFirstIndex[i] is where level i starts and lodFirstIndex.back() is indexOut.size().
+void GenerateSphereLODs(std::vector<glm::vec3> &posOut, std::vector<unsigned int> &indexOut, std::vector<unsigned int> &lodFirstIndex, unsigned int maxSubdivision)
+{
+    std::vector<std::vector<unsigned int>> levels(1);
+    GenerateSphere(posOut, levels[0], 0);
+    for(glm::vec3 &vert : posOut)
+        vert = vert/glm::length(vert);
+    for(unsigned int i = 0; i < maxSubdivision; i++) // subdividing keeps the existing vertices, so coarser levels stay valid
+    {
+        levels.push_back(levels.back());
+        mGLu::Subdivide(levels.back(), posOut);
+        for(glm::vec3 &vert : posOut)
+            vert = vert/glm::length(vert);
+    }
+    indexOut.clear();
+    lodFirstIndex.clear();
+    for(auto level = levels.rbegin(); level != levels.rend(); ++level)
+    {
+        lodFirstIndex.push_back(indexOut.size());
+        indexOut.insert(indexOut.end(), level->begin(), level->end());
+    }
+    lodFirstIndex.push_back(indexOut.size());
+}
 class BallHandler
 {
-    mGLu::FixedBuffer instanceBuffer;
-    mGLu::Drawable ball;
+    mGLu::StreamBuffer instanceBuffer; // CPU simulated balls in draw order, packed straight into mapped memory, as __instanceData only for GPU sorting
+    mGLu::FixedBuffer sortedInstanceBuffer;
+    GLsizei instanceCount = 0; // balls in the current region of instanceBuffer
+    mGLu::StreamBuffer drawCommandStream; // one DrawElementsIndirectCommand per LOD run of the CPU simulated balls
+    GLsizei drawCommandCount = 0;
+    struct __lod
+    {
+        GLuint firstIndex, indexCount;
+    };
+    std::vector<__lod> lods; // lods[0] is the finest sphere
+    __lod impostorQuad; // 4 vertex quad the impostor shaders expand per ball
+    float pixelsPerUnit = 1.f; // of the camera passed to the last Update, the tessellation levels depend on it
+    mGLu::Drawable ball, packedBall; // same mesh and shaders, ball reads __instanceData and packedBall __packedInstance
+    glm::vec3 instanceOrigin{0.f}; // camera position the packed instances of this frame are relative to
 
     const glm::vec3 minAquarium, maxAquarium;
     float minBallScale, maxBallScale;
@@ -288,15 +539,355 @@ class BallHandler
         glm::vec3 col;
         
     };
+    struct __packedInstance // what the CPU simulation uploads for drawing, the GPU paths work on __instanceData
+    {
+        GLuint posXY;       // half floats, relative to instanceOrigin
+        GLuint posZscale;   // half floats
+        GLuint col;         // RGBA8 unorm
+    };
+    using __ballVertex = mGLu::VertexLayout<mGLu::Attr<"inPos", float, 3>>;
+    using __ballInstance = mGLu::VertexLayout<mGLu::Attr<"instancePos", float, 3, 1>, mGLu::Attr<"instanceScale", float, 1, 1>,
+                                              mGLu::Pad<sizeof(float)>, mGLu::Attr<"instanceCol", float, 3, 1>>; // skips initScale
+    using __packedBallInstance = mGLu::VertexLayout<mGLu::Attr<"instancePos", mGLu::Half, 3, 1>, mGLu::Attr<"instanceScale", mGLu::Half, 1, 1>,
+                                                    mGLu::Attr<"instanceCol", GLubyte, 3, 1, true>>;
+    using __ballFormat = mGLu::VertexFormat<__ballVertex, __ballInstance>;
+    using __packedBallFormat = mGLu::VertexFormat<__ballVertex, __packedBallInstance>;
+    static_assert(__ballInstance::stride == sizeof(__instanceData) && __ballInstance::OffsetOf<"instanceScale">() == offsetof(__instanceData, scale)
+                  && __ballInstance::OffsetOf<"instanceCol">() == offsetof(__instanceData, col), "__ballInstance does not match __instanceData");
+    static_assert(__packedBallInstance::stride == sizeof(__packedInstance) && __packedBallInstance::OffsetOf<"instanceScale">() == offsetof(__packedInstance, posZscale) + sizeof(GLushort)
+                  && __packedBallInstance::OffsetOf<"instanceCol">() == offsetof(__packedInstance, col), "__packedBallInstance does not match __packedInstance");
+    static_assert(std::string_view(__ballFormat::declaration.data()) == std::string_view(__packedBallFormat::declaration.data()), "ball and packedBall share their shaders");
     Random rng;
     const mGLu::Window &window;
+    float nextBallSpawnTime = 0.f;
+
+    BallSimulationGPU<__instanceData> gpuSimulation;
+    bool useGPUSimulation = false;
+
+    mGLu::GPUSorter gpuSorter;
+    mGLu::ComputeShader sortKeyShader;
+
+    WeightedBlendedOIT oit;
+    enum BallShaderOption : unsigned int { GeometryOption, OITPassOption, TransparentBallsOption, UsePhongOption, WaterOcclusionOption, LightCountOption };
+    mGLu::ShaderVariants shaders;
+    mGLu::ShaderVariants::Key shaderKey = 0; // geometry and OIT pass are kept in sync with geometry and useOIT by SelectShader
+    bool useOIT = false;
+
+    glm::vec3 waterCol{0.36f, 0.61f, 1.f}; // defaults of the ball shaders
+    float waterAbsorbance = 0.02f;
+    bool doWaterOcclusion = true;
+
+    BallPhysics physics;
+    bool usePhysics = false;
+
+    struct __ballStreams // CPU simulated balls as structure of arrays, packed into __instanceData only for upload
+    {
+        std::vector<float> posX, posY, posZ, scale, initScale, colR, colG, colB;
+        std::vector<float> prevPosX, prevPosY, prevPosZ; // positions before the last Simulate
+        std::vector<float> velX, velY, velZ; // only used by the physics mode
+    } balls;
+    std::vector<__instanceData> instanceData; // staging for moving balls between the CPU and GPU simulation
+    std::vector<std::uint8_t> removeFlags, visibleFlags;
+    std::vector<unsigned int> drawList, drawListScratch; // balls that passed culling, in draw order
+    std::vector<std::uint8_t> drawLods; // drawLods[i] is the LOD of drawList[i]
+    std::vector<unsigned int> compactRemap;
+    std::vector<float> depthKeys; // depthKeys[i] is the back-to-front key of ball i
+    std::vector<std::pair<float, unsigned int>> drawOrder; // (key, ball index) in draw order, kept between frames so sorting only has to repair it
+    glm::vec3 lastSortCameraPos{0.f};
+    BallGrid grid; // rebuilt from the streams every CPU Update
+
+    mGLu::JobSystem *jobs;
+    static constexpr std::size_t jobGrainSize = 256; // balls per job, a multiple of the SIMD width
+    template<typename Func>
+    void ForChunks(std::size_t count, Func &&func) // func(begin, end) over [0, count), spread across the job system if there is one
+    {
+        if(jobs)
+            jobs->ParallelFor(0, count, jobGrainSize, func);
+        else
+            func(0, count);
+    }
+
+    std::size_t BallCount() const
+    {
+        return balls.posX.size();
+    }
+    void PushBall(const __instanceData &ballData)
+    {
+        drawOrder.push_back({0.f, (unsigned int)BallCount()});
+        balls.posX.push_back(ballData.pos.x);
+        balls.posY.push_back(ballData.pos.y);
+        balls.posZ.push_back(ballData.pos.z);
+        balls.prevPosX.push_back(ballData.pos.x);
+        balls.prevPosY.push_back(ballData.pos.y);
+        balls.prevPosZ.push_back(ballData.pos.z);
+        balls.velX.push_back(0.f);
+        balls.velY.push_back(ballVelocity);
+        balls.velZ.push_back(0.f);
+        balls.scale.push_back(ballData.scale);
+        balls.initScale.push_back(ballData.initScale);
+        balls.colR.push_back(ballData.col.x);
+        balls.colG.push_back(ballData.col.y);
+        balls.colB.push_back(ballData.col.z);
+    }
+    __instanceData GetBall(unsigned int i) const
+    {
+        return {{balls.posX[i], balls.posY[i], balls.posZ[i]}, balls.scale[i], balls.initScale[i], {balls.colR[i], balls.colG[i], balls.colB[i]}};
+    }
+    void ClearBalls()
+    {
+        for(std::vector<float> *stream : {&balls.posX, &balls.posY, &balls.posZ, &balls.prevPosX, &balls.prevPosY, &balls.prevPosZ, &balls.velX, &balls.velY, &balls.velZ,
+                                             &balls.scale, &balls.initScale, &balls.colR, &balls.colG, &balls.colB})
+            stream->clear();
+        drawOrder.clear();
+        grid.Clear();
+    }
+    void CompactBalls() // drops balls flagged in removeFlags, keeping both the storage and the draw order stable
+    {
+        const std::size_t count = BallCount();
+        compactRemap.resize(count);
+        unsigned int aliveN = 0;
+        for(std::size_t i = 0; i < count; i++)
+            compactRemap[i] = removeFlags[i] ? ~0u : aliveN++;
+        for(std::vector<float> *stream : {&balls.posX, &balls.posY, &balls.posZ, &balls.prevPosX, &balls.prevPosY, &balls.prevPosZ, &balls.velX, &balls.velY, &balls.velZ,
+                                             &balls.scale, &balls.initScale, &balls.colR, &balls.colG, &balls.colB})
+        {
+            float *data = stream->data();
+            for(std::size_t i = 0; i < count; i++)
+                if(compactRemap[i] != ~0u)
+                    data[compactRemap[i]] = data[i];
+            stream->resize(aliveN);
+        }
+        unsigned int orderN = 0;
+        for(std::pair<float, unsigned int> entry : drawOrder)
+            if(compactRemap[entry.second] != ~0u)
+                drawOrder[orderN++] = {entry.first, compactRemap[entry.second]};
+        drawOrder.resize(orderN);
+    }
+    glm::vec3 InterpolatedPos(unsigned int i, float interpolation) const
+    {
+        return glm::vec3(balls.prevPosX[i], balls.prevPosY[i], balls.prevPosZ[i]) * (1.f - interpolation) +
+               glm::vec3(balls.posX[i], balls.posY[i], balls.posZ[i]) * interpolation;
+    }
+    void CullInstances(const mGLu::Frustum &frustum, glm::vec3 cameraPos, float interpolation) // fills drawList with the balls in the view and not lost in the water, in draw order
+    {
+        const float cullDistance = WaterCullDistance();
+        visibleFlags.resize(drawOrder.size());
+        ForChunks(drawOrder.size(), [&](std::size_t begin, std::size_t end){
+            for(std::size_t i = begin; i < end; i++)
+            {
+                const unsigned int b = drawOrder[i].second;
+                const glm::vec3 pos = InterpolatedPos(b, interpolation);
+                const glm::vec3 toBall = pos - cameraPos;
+                const float reach = cullDistance + balls.scale[b]; // the closest point of the ball counts
+                visibleFlags[i] = glm::dot(toBall, toBall) <= reach * reach && frustum.IntersectsSphere(pos, balls.scale[b]);
+            }
+        });
+        drawList.clear();
+        for(std::size_t i = 0; i < drawOrder.size(); i++)
+            if(visibleFlags[i])
+                drawList.push_back(drawOrder[i].second);
+    }
+    void AssignLODs(glm::vec3 cameraPos, float pixelsPerUnit, float interpolation) // picks drawLods from the screen radius, pixelsPerUnit is the size of one unit at distance 1
+    {
+        const int maxLod = lods.size() - 1;
+        drawLods.resize(drawList.size());
+        ForChunks(drawList.size(), [&](std::size_t begin, std::size_t end){
+            for(std::size_t i = begin; i < end; i++)
+            {
+                const unsigned int b = drawList[i];
+                float dist = glm::distance(cameraPos, InterpolatedPos(b, interpolation));
+                float screenRadius = balls.scale[b] * pixelsPerUnit / std::max(dist, 1e-3f);
+                int lod = screenRadius >= lodBaseRadius ? 0 : (int)std::log2(lodBaseRadius / screenRadius) + 1; // every coarser LOD halves the radius it is used below
+                drawLods[i] = std::min(lod, maxLod);
+            }
+        });
+
+        // every LOD has to form one contiguous run so it can be drawn by a single command
+        if(useOIT) // order does not matter, group by LOD
+        {
+            std::size_t lodStart[256] = {};
+            for(std::uint8_t lod : drawLods)
+                lodStart[lod + 1]++;
+            for(int lod = 1; lod <= maxLod; lod++)
+                lodStart[lod] += lodStart[lod - 1];
+            drawListScratch.resize(drawList.size());
+            for(std::size_t i = 0; i < drawList.size(); i++)
+                drawListScratch[lodStart[drawLods[i]]++] = drawList[i];
+            drawList.swap(drawListScratch);
+            std::sort(drawLods.begin(), drawLods.end());
+        }
+        else if(sortMode == SortMode::GPU) // the final order is only known on the GPU, draw everything at the finest LOD any ball needs
+        {
+            std::uint8_t finest = drawLods.empty() ? 0 : *std::min_element(drawLods.begin(), drawLods.end());
+            std::fill(drawLods.begin(), drawLods.end(), finest);
+        }
+        else // back to front, a ball never gets a coarser LOD than the one drawn before it, so the LOD only ever refines along the order
+        {
+            for(std::size_t i = 1; i < drawLods.size(); i++)
+                drawLods[i] = std::min(drawLods[i], drawLods[i-1]);
+        }
+    }
+    void PackInstances(__instanceData *dst, float interpolation = 1.f) // interleaves the streams of the balls in drawList into dst, positions interpolated from the previous Simulate
+    {
+        ForChunks(drawList.size(), [&](std::size_t begin, std::size_t end){
+            for(std::size_t i = begin; i < end; i++)
+            {
+                const unsigned int b = drawList[i];
+                __instanceData ballData = GetBall(b);
+                ballData.pos = InterpolatedPos(b, interpolation);
+                dst[i] = ballData; // one whole store per ball, dst may be write combined memory
+            }
+        });
+    }
+    void PackInstances(__packedInstance *dst, glm::vec3 origin, float interpolation = 1.f) // same for the packed format, positions relative to origin
+    {
+        ForChunks(drawList.size(), [&](std::size_t begin, std::size_t end){
+            for(std::size_t i = begin; i < end; i++)
+            {
+                const unsigned int b = drawList[i];
+                const glm::vec3 pos = InterpolatedPos(b, interpolation) - origin;
+                dst[i] = {glm::packHalf2x16({pos.x, pos.y}), glm::packHalf2x16({pos.z, balls.scale[b]}),
+                          glm::packUnorm4x8({balls.colR[b], balls.colG[b], balls.colB[b], 1.f})};
+            }
+        });
+    }
+    __instanceData GenerateBall()
+    {
+        __instanceData ballData;
+
+        ballData.initScale = ballData.scale = (maxBallScale - minBallScale) * rng.random() + minBallScale;
+        
+        for(int i = 0; i < 3; i++)
+            ballData.pos[i] = (maxAquarium[i] - minAquarium[i] - 2.f * ballData.initScale * 1.3f) * rng.random() + minAquarium[i] + ballData.initScale * 1.3f;
+
+        ballData.pos.y = minAquarium.y - ballData.initScale;
+        
+        ballData.col = {rng.random(), rng.random(), rng.random()};
+        ballData.col = glm::normalize(ballData.col);
+        return ballData;
+    }
+    void SortInstances(glm::vec3 cameraPos)
+    {
+        depthKeys.resize(BallCount());
+        ForChunks(BallCount(), [&](std::size_t begin, std::size_t end){
+            ComputeDepthKeys(balls.posX.data() + begin, balls.posY.data() + begin, balls.posZ.data() + begin, balls.scale.data() + begin, depthKeys.data() + begin,
+                             end - begin, cameraPos.x, cameraPos.y, cameraPos.z);
+        });
+        ForChunks(drawOrder.size(), [&](std::size_t begin, std::size_t end){
+            for(std::size_t i = begin; i < end; i++)
+                drawOrder[i].first = depthKeys[drawOrder[i].second];
+        });
+
+        bool cameraJumped = glm::distance(cameraPos, lastSortCameraPos) > sortCameraJumpDistance;
+        lastSortCameraPos = cameraPos;
+
+        if(sortMode == SortMode::Full || cameraJumped || !IncrementalSort())
+            FullSort();
+    }
+    bool IncrementalSort() // insertion sort over last frame's order, returns false (leaving a partially sorted array) once it runs out of budget
+    {
+        std::size_t shiftBudget = 4 * drawOrder.size() + 64;
+        for(std::size_t i = 1; i < drawOrder.size(); i++)
+        {
+            const std::pair<float, unsigned int> entry = drawOrder[i];
+            if(drawOrder[i-1].first >= entry.first)
+                continue;
+            std::size_t j = i;
+            do
+            {
+                drawOrder[j] = drawOrder[j-1];
+                --j;
+            } while(j > 0 && drawOrder[j-1].first < entry.first && --shiftBudget);
+            drawOrder[j] = entry;
+            if(!shiftBudget)
+                return false;
+        }
+        return true;
+    }
+    void GPUSort(mGLu::Buffer &balls, glm::vec3 cameraPos, GLuint ballCount, int drawCommandIndex, GLintptr ballsOffset = 0) // sorts balls into sortedInstanceBuffer
+    {
+        gpuSorter.Reset();
+        balls.BindToSSBO(2, balls.GetSize() - ballsOffset, ballsOffset);
+        gpuSimulation.GetDrawCommandBuffer().BindToSSBO(5);
+        gpuSorter.BindKeyValues(7);
+        sortKeyShader.Use();
+        glUniform3f(0, cameraPos.x, cameraPos.y, cameraPos.z);
+        glUniform1ui(1, ballCount);
+        glUniform1i(2, drawCommandIndex);
+        sortKeyShader.Dispatch((maxBallCount + 63) / 64);
+
+        gpuSorter.Sort();
+        gpuSorter.Gather(balls, sortedInstanceBuffer, sizeof(__instanceData), ballsOffset);
+    }
+    BallPhysics::Streams PhysicsStreams()
+    {
+        return {balls.posX.data(), balls.posY.data(), balls.posZ.data(), balls.velX.data(), balls.velY.data(), balls.velZ.data(), balls.scale.data()};
+    }
+    void CollidePhysics() // resolves contacts with the grid as broadphase, the grid is then reused for the player query instead of rebuilt
+    {
+        const BallPhysics::Streams streams = PhysicsStreams();
+        physics.Collide(streams, BallCount(), grid, jobs, jobGrainSize);
+        std::vector<float> chunkDrift((BallCount() + jobGrainSize - 1) / jobGrainSize, 0.f);
+        ForChunks(BallCount(), [&](std::size_t begin, std::size_t end){
+            physics.ConstrainToWalls(streams, begin, end, minAquarium, maxAquarium);
+            chunkDrift[begin / jobGrainSize] = grid.Drift(begin, end);
+        });
+        grid.SetSlack(chunkDrift.empty() ? 0.f : *std::max_element(chunkDrift.begin(), chunkDrift.end()));
+    }
+    void SelectShader() // compiles the variant if it is the first time it is used
+    {
+        shaderKey = shaders.With(shaders.With(shaderKey, GeometryOption, (unsigned int)geometry), OITPassOption, useOIT);
+        ball.shader = shaders.Get(shaderKey);
+        packedBall.shader = ball.shader;
+    }
+    void SetShaderOption(BallShaderOption option, unsigned int value)
+    {
+        shaderKey = shaders.With(shaderKey, option, value);
+        SelectShader();
+    }
+    const __lod& GeometryMesh() const // what the current geometry draws when every ball uses the same mesh
+    {
+        switch(geometry)
+        {
+        case BallGeometry::Impostor:
+            return impostorQuad;
+        case BallGeometry::Tessellated:
+            return lods.back(); // the icosahedron
+        default:
+            return lods[0];
+        }
+    }
+    void FullSort()
+    {
+        std::sort(drawOrder.begin(), drawOrder.end(), [](const std::pair<float, unsigned int> &a, const std::pair<float, unsigned int> &b){
+            return a.first > b.first;
+        });
+    }
 public:
-    std::vector<__instanceData> instanceData;
+    enum class SortMode
+    {
+        Full,       // std::sort every frame
+        Incremental,// repairs last frame's order, falls back to Full when the camera jumps or the order got too far off
+        GPU         // bitonic sort in compute shaders, always used for GPU simulated balls
+    };
+    SortMode sortMode = SortMode::Incremental;
+    enum class BallGeometry
+    {
+        LOD,        // icospheres picked by screen size
+        Impostor,   // ray cast quads
+        Tessellated // icosahedron patches subdivided by screen size
+    };
+    BallGeometry geometry = BallGeometry::LOD;
+    float tessEdgePixels = 8.f; // target screen length of tessellated edges
+    float sortCameraJumpDistance = 1.f;
+    float lodBaseRadius = 256.f; // screen radius in pixels below which balls start using coarser LODs
+    float waterCullThreshold = 0.5f / 255.f; // CPU simulated balls dimmed below this by the water are not drawn, 0 disables it. GPU simulated balls are never culled
+
     float minSpawnTime, maxSpawnTime;
 
     BallHandler(const mGLu::Window *window, unsigned int seed, 
                 glm::vec3 _minAquarium, glm::vec3 _maxAquarium, float _minSpawnTime, float _maxSpawnTime, float _minBallScale, float _maxBallScale,
-                unsigned int _maxBallCount, unsigned int ballSubdivision = 6):
+                unsigned int _maxBallCount, mGLu::BufferArena &meshArena, unsigned int ballSubdivision = 6, mGLu::JobSystem *_jobs = nullptr):
         minAquarium(_minAquarium),
         maxAquarium(_maxAquarium),
         minSpawnTime(_minSpawnTime),
@@ -305,104 +896,359 @@ public:
         maxBallScale(_maxBallScale),
         maxBallCount(_maxBallCount),
         rng(seed),
-        window(*window)
+        window(*window),
+        gpuSimulation(*window, _maxBallCount),
+        gpuSorter(*window, _maxBallCount, true),
+        sortKeyShader(*window, ballSortKeyCScode),
+        oit(window),
+        jobs(_jobs)
     {
-        mGLu::VAO vao;
-        GLuint vertexBind = vao.AddAttrib(GL_FLOAT, 3, "inPos");
-        GLuint instancePosBind = vao.AddAttrib(GL_FLOAT, 3, "instancePos", 1);
-        GLuint instanceScaleBind = vao.AddAttrib(GL_FLOAT, 1, "instanceScale", 1);
-        GLuint instanceColBind = vao.AddAttrib(GL_FLOAT, 3, "instanceCol", 1);
+        mGLu::VAO vao = mGLu::VAO::FromFormat<__ballFormat>();
         ball.vao = vao;
+        packedBall.vao = mGLu::VAO::FromFormat<__packedBallFormat>();
 
         std::vector<glm::vec3> vertices;
-        std::vector<GLuint> indices;
-        GenerateSphere(vertices, indices, ballSubdivision);
-        
-        ball.buffers.push_back(mGLu::FixedBuffer(vertices.size(), vertices.data()));
-        ball.SetBinding(vertexBind, 0, 0, sizeof(glm::vec3));
-        
-        ball.indexBuffer = mGLu::FixedBuffer(indices.size(), indices.data());
+        std::vector<GLuint> indices, lodFirstIndex;
+        GenerateSphereLODs(vertices, indices, lodFirstIndex, ballSubdivision);
+        const mGLu::BufferRange vertexRange = meshArena.Allocate(vertices.size(), vertices.data());
+        const GLuint quadFirstIndex = indices.size();
+        indices.insert(indices.end(), {0, 1, 2, 2, 1, 3}); // corners come from gl_VertexID, the vertices themselves are unused
+        const mGLu::BufferRange indexRange = meshArena.Allocate(indices.size(), indices.data());
+
+        const GLuint baseIndex = indexRange.offset / sizeof(GLuint); // indirect draws only know indices relative to the start of the buffer
+        for(std::size_t i = 0; i + 1 < lodFirstIndex.size(); i++)
+            lods.push_back({baseIndex + lodFirstIndex[i], lodFirstIndex[i+1] - lodFirstIndex[i]});
+        impostorQuad = {baseIndex + quadFirstIndex, 6};
         
+        ball.SetBindings<__ballFormat, __ballVertex>(vertexRange);
+        ball.SetIndexBuffer(indexRange);
+        gpuSimulation.SetMeshIndexCount(lods[0].indexCount, lods[0].firstIndex); // the GPU simulation always draws the finest LOD
+        drawCommandStream = mGLu::StreamBuffer(lods.size() * sizeof(mGLu::DrawElementsIndirectCommand), 3, sizeof(mGLu::DrawElementsIndirectCommand));
 
-        instanceBuffer = mGLu::FixedBuffer(maxBallCount * sizeof(__instanceData), nullptr, GL_DYNAMIC_STORAGE_BIT);
+        instanceBuffer = mGLu::StreamBuffer(maxBallCount * sizeof(__instanceData), 3, std::lcm(sizeof(__instanceData), sizeof(__packedInstance))); // regions hold whole instances of either format
+        sortedInstanceBuffer = mGLu::FixedBuffer(maxBallCount * sizeof(__instanceData), nullptr, 0);
         ball.buffers.push_back(instanceBuffer);
-        ball.SetBinding(instancePosBind, 1, offsetof(__instanceData, pos), sizeof(__instanceData));
-        ball.SetBinding(instanceScaleBind, 1, offsetof(__instanceData, scale), sizeof(__instanceData));
-        ball.SetBinding(instanceColBind, 1, offsetof(__instanceData, col), sizeof(__instanceData));
+        ball.SetBindings<__ballFormat, __ballInstance>(1);
+
+        packedBall.buffers = {ball.buffers[0], instanceBuffer};
+        packedBall.SetIndexBuffer(indexRange);
+        packedBall.SetBindings<__packedBallFormat, __ballVertex>(vertexRange);
+        packedBall.SetBindings<__packedBallFormat, __packedBallInstance>(1);
 
-        ball.shader = mGLu::Shader(*window, (vao.GetShaderPrefix() + ballVScode).c_str(), (std::string(lightBufferPrefixCode) + ballFScode).c_str());
+        shaders = mGLu::ShaderVariants({{"BALL_GEOMETRY", 3}, {"OIT_PASS"}, {"TRANSPARENT_BALLS", 2, 1}, {"USE_PHONG"}, {"WATER_OCCLUSION", 2, 1},
+                                        {"LIGHT_COUNT", maxPointLights + 1, maxPointLights}},
+            [this, window, vsPrefix = std::string(vao.GetShaderPrefix())](mGLu::ShaderVariants::Key key, const std::string &defines) -> mGLu::Shader {
+                switch((BallGeometry)shaders.GetValue(key, GeometryOption))
+                {
+                case BallGeometry::LOD:
+                    return mGLu::Shader(*window, (vsPrefix + ballVScode).c_str(), (defines + lightBufferPrefixCode + ballFScode).c_str());
+                case BallGeometry::Impostor:
+                    return mGLu::Shader(*window, (vsPrefix + ballImpostorVScode).c_str(),
+                        ("#define IMPOSTOR\n" + defines + lightBufferPrefixCode + ballFScode).c_str());
+                default:
+                    return mGLu::TessellationShader(*window, (vsPrefix + ballTessVScode).c_str(), ballTessControlCode, ballTessEvalCode,
+                        (defines + lightBufferPrefixCode + ballFScode).c_str());
+                }
+            },
+            [this](mGLu::Shader&){ // SetWater() may have run before this variant existed
+                glUniform3f(5, waterCol.x, waterCol.y, waterCol.z);
+                glUniform1f(9, waterAbsorbance);
+            });
+        shaderKey = shaders.GetDefaultKey(); // nothing is compiled before SetLightCount()
 
+        grid.Resize(minAquarium, maxAquarium, maxBallScale * 1.3f); // balls grow by up to 30% on their way up
     }
-    void Update(glm::vec3 cameraPos)
+    void Simulate(glm::vec3 playerPos, float playerRadius) // advances the balls by window.DeltaTime(), deterministic when called from FixedUpdate
     {
-        static float nextBallSpawnTime = 0.f;
         if(nextBallSpawnTime < window.GetTime())
         {
             nextBallSpawnTime = window.GetTime() + (maxSpawnTime-minSpawnTime)*rng.random() + minSpawnTime;
 
-            if(instanceData.size() < maxBallCount)
-            {
-                __instanceData ballData;
-
-                ballData.initScale = ballData.scale = (maxBallScale - minBallScale) * rng.random() + minBallScale;
-                
-                for(int i = 0; i < 3; i++)
-                    ballData.pos[i] = (maxAquarium[i] - minAquarium[i] - 2.f * ballData.initScale * 1.3f) * rng.random() + minAquarium[i] + ballData.initScale * 1.3f;
-
-                ballData.pos.y = minAquarium.y - ballData.initScale;
-                
-                ballData.col = {rng.random(), rng.random(), rng.random()};
-                ballData.col = glm::normalize(ballData.col);
-
-                instanceData.push_back(ballData);
-            }
-            
+            if(useGPUSimulation)
+                gpuSimulation.Spawn(GenerateBall()); // the GPU enforces maxBallCount itself
+            else if(BallCount() < maxBallCount)
+                PushBall(GenerateBall());
         }
 
+        if(useGPUSimulation)
+        {
+            gpuSimulation.Step(window.DeltaTime(), ballVelocity, minAquarium, maxAquarium, playerPos, playerRadius);
+            return;
+        }
 
-        for(int i = 0; i < instanceData.size(); )
+        // integration, key computation, cell assignment and packing run in chunks on the job system, GL calls stay on this thread
+        removeFlags.resize(BallCount());
+        std::atomic<std::size_t> removeCount{0};
+        ForChunks(BallCount(), [&](std::size_t begin, std::size_t end){
+            std::copy(balls.posX.begin() + begin, balls.posX.begin() + end, balls.prevPosX.begin() + begin);
+            std::copy(balls.posY.begin() + begin, balls.posY.begin() + end, balls.prevPosY.begin() + begin);
+            std::copy(balls.posZ.begin() + begin, balls.posZ.begin() + end, balls.prevPosZ.begin() + begin);
+        });
+        if(usePhysics)
+            ForChunks(BallCount(), [&](std::size_t begin, std::size_t end){
+                physics.Integrate(PhysicsStreams(), begin, end, window.DeltaTime(), ballVelocity);
+            });
+        const float deltaY = usePhysics ? 0.f : ballVelocity * window.DeltaTime(); // physics already moved the balls, only grow and despawn them
+        ForChunks(BallCount(), [&](std::size_t begin, std::size_t end){
+            removeCount += IntegrateBalls(balls.posY.data() + begin, balls.scale.data() + begin, balls.initScale.data() + begin, removeFlags.data() + begin,
+                                          end - begin, deltaY, minAquarium.y, maxAquarium.y);
+        });
+        if(removeCount)
+            CompactBalls();
+        grid.Prepare(balls.posX.data(), balls.posY.data(), balls.posZ.data(), balls.scale.data(), BallCount());
+        ForChunks(BallCount(), [&](std::size_t begin, std::size_t end){
+            grid.AssignCells(begin, end);
+        });
+        grid.Build();
+        if(usePhysics)
+            CollidePhysics();
+    }
+    void Update(glm::vec3 cameraPos, const mGLu::Camera &camera, float interpolation = 1.f) // culls, sorts, picks LODs and uploads the balls for Submit(), interpolation is how far rendering is between the last two Simulate calls
+    {
+        pixelsPerUnit = camera.projection[1][1] * camera.GetSize().y * 0.5f;
+        if(useGPUSimulation) // GPU simulated balls are drawn as of the last step and are not culled
+        {
+            if(!useOIT)
+                GPUSort(gpuSimulation.GetStateBuffer(), cameraPos, 0, gpuSimulation.GetStateIndex());
+            return;
+        }
+        if(!useOIT && sortMode != SortMode::GPU)
+            SortInstances(cameraPos);
+        CullInstances(camera.GetFrustum(), cameraPos, interpolation);
+        if(geometry == BallGeometry::LOD)
+            AssignLODs(cameraPos, pixelsPerUnit, interpolation);
+        else
+            drawLods.assign(drawList.size(), 0); // one run, drawn with GeometryMesh()
+        instanceCount = drawList.size();
+        const bool gpuSorted = !useOIT && sortMode == SortMode::GPU;
+        if(gpuSorted) // the sort and gather shaders work on __instanceData
         {
-            if((instanceData[i].pos.y += ballVelocity * window.DeltaTime()) + instanceData[i].scale > maxAquarium.y)
+            PackInstances(instanceBuffer.BeginWrite<__instanceData>(), interpolation);
+            GPUSort(instanceBuffer, cameraPos, instanceCount, -1, instanceBuffer.GetOffset());
+        }
+        else
+        {
+            instanceOrigin = cameraPos;
+            PackInstances(instanceBuffer.BeginWrite<__packedInstance>(), instanceOrigin, interpolation);
+        }
+
+        mGLu::DrawElementsIndirectCommand *commands = drawCommandStream.BeginWrite<mGLu::DrawElementsIndirectCommand>();
+        const GLuint baseInstance = gpuSorted ? 0 : instanceBuffer.GetOffset() / sizeof(__packedInstance);
+        drawCommandCount = 0;
+        for(std::size_t runStart = 0, i = 1; runStart < drawLods.size(); i++)
+            if(i == drawLods.size() || drawLods[i] != drawLods[runStart])
             {
-                instanceData[i] = instanceData.back();
-                instanceData.pop_back();
+                const __lod &lod = geometry == BallGeometry::LOD ? lods[drawLods[runStart]] : GeometryMesh();
+                commands[drawCommandCount++] = {lod.indexCount, GLuint(i - runStart), lod.firstIndex, 0, GLuint(baseInstance + runStart)};
+                runStart = i;
             }
-            else
+    }
+    void Submit(mGLu::RenderQueue &queue, glm::vec3 cameraPos) // all balls go as one transparent packet, they are already in draw order
+    {
+        const bool packed = !useGPUSimulation && (useOIT || sortMode != SortMode::GPU);
+        if(useOIT)
+            ball.buffers[1] = useGPUSimulation ? gpuSimulation.GetStateBuffer() : instanceBuffer;
+        else
+            ball.buffers[1] = useGPUSimulation || sortMode == SortMode::GPU ? sortedInstanceBuffer : instanceBuffer;
+        mGLu::Drawable &drawable = packed ? packedBall : ball;
+        const glm::vec3 origin = packed ? instanceOrigin : glm::vec3(0.f);
+
+        mGLu::RenderPacket packet;
+        packet.key = mGLu::RenderQueue::MakeKey(mGLu::RenderPass::Transparent, drawable, 0, glm::distance(cameraPos, (minAquarium + maxAquarium) / 2.f));
+        packet.drawable = &drawable;
+        packet.drawMode = geometry == BallGeometry::Tessellated ? GL_PATCHES : GL_TRIANGLES;
+        if(useGPUSimulation)
+        {
+            packet.indirectBuffer = &gpuSimulation.GetDrawCommandBuffer();
+            packet.indirectOffset = gpuSimulation.GetDrawCommandOffset();
+        }
+        else
+        {
+            packet.indirectBuffer = &drawCommandStream;
+            packet.indirectOffset = drawCommandStream.GetOffset();
+            packet.indirectCount = drawCommandCount;
+        }
+        packet.setup = [this, origin]{
+            glUniform3f(14, origin.x, origin.y, origin.z);
+            if(geometry == BallGeometry::Tessellated)
             {
-                instanceData[i].scale = instanceData[i].initScale * (1.f + 0.3f * (instanceData[i].pos.y - minAquarium.y) / (maxAquarium.y - minAquarium.y));
-                ++i;
+                glUniform1f(15, pixelsPerUnit);
+                glUniform1f(16, tessEdgePixels);
             }
+            if(useOIT)
+                oit.Begin(glm::ivec2(window.GetSize()));
+        };
+        if(useOIT)
+            packet.finish = [this]{ oit.End(); };
+        queue.Submit(std::move(packet));
+    }
+    void Clear()
+    {
+        ClearBalls();
+        instanceCount = 0;
+        gpuSimulation.Clear();
+    }
+    bool OverlapsSphere(glm::vec3 center, float radius) const // CPU simulation only, checks the balls as of the last Update
+    {
+        return grid.OverlapsSphere(center, radius);
+    }
+    bool NearestBall(glm::vec3 point, glm::vec3 &ballPos, float &ballScale) const // CPU simulation only, false if there are no balls
+    {
+        int i = grid.Nearest(point);
+        if(i < 0)
+            return false;
+        ballPos = {balls.posX[i], balls.posY[i], balls.posZ[i]};
+        ballScale = balls.scale[i];
+        return true;
+    }
+    bool IsGPUSimulated() const
+    {
+        return useGPUSimulation;
+    }
+    bool GPUPlayerHit() const // collision result of the last GPU step, CPU simulated balls are tested through OverlapsSphere
+    {
+        return gpuSimulation.PlayerHit();
+    }
+    void ToggleGPUSimulation() // hands the current balls over to the other backend
+    {
+        if(useGPUSimulation)
+        {
+            gpuSimulation.Download(instanceData);
+            gpuSimulation.Clear();
+            for(const __instanceData &ballData : instanceData)
+                PushBall(ballData);
         }
-
-        std::function<bool(__instanceData, __instanceData)> instanceCompare;
-
-        std::sort(instanceData.begin(), instanceData.end(), [cameraPos](__instanceData a, __instanceData b){
-            float weightA = glm::distance(a.pos, cameraPos) - a.scale;
-            float weightB = glm::distance(b.pos, cameraPos) - b.scale;
-            return weightA > weightB;
-        });
-        instanceBuffer.SetData(0, instanceData.size(), instanceData.data());
+        else
+        {
+            instanceData.resize(BallCount());
+            for(std::size_t i = 0; i < BallCount(); i++)
+                instanceData[i] = GetBall(i);
+            gpuSimulation.Upload(instanceData);
+            ClearBalls();
+            instanceData.clear();
+        }
+        useGPUSimulation = !useGPUSimulation;
     }
-    void Draw()
+    void ToggleOIT() // weighted blended OIT needs no sorting at all
     {
-        ball.DrawIndexedInstanced(instanceData.size(), ball.indexBuffer.GetSize()/sizeof(GLuint), GL_TRIANGLES, GL_UNSIGNED_INT);
+        useOIT = !useOIT;
+        SelectShader();
+    }
+    void ToggleGeometry() // cycles LOD -> Impostor -> Tessellated
+    {
+        switch(geometry)
+        {
+        case BallGeometry::LOD:
+            geometry = BallGeometry::Impostor;
+            break;
+        case BallGeometry::Impostor:
+            geometry = BallGeometry::Tessellated;
+            break;
+        case BallGeometry::Tessellated:
+            geometry = BallGeometry::LOD;
+            break;
+        }
+        SelectShader();
+        const __lod &mesh = GeometryMesh();
+        gpuSimulation.SetMeshIndexCount(mesh.indexCount, mesh.firstIndex);
+    }
+    const char* GetGeometryName() const
+    {
+        switch(geometry)
+        {
+        case BallGeometry::LOD:
+            return "icosphere LODs";
+        case BallGeometry::Impostor:
+            return "ray cast impostors";
+        default:
+            return "tessellated";
+        }
+    }
+    void TogglePhysics() // CPU simulation only, the GPU simulation keeps moving balls straight up
+    {
+        usePhysics = !usePhysics;
+    }
+    bool IsPhysicsUsed() const
+    {
+        return usePhysics;
+    }
+    const BallPhysicsStats& GetPhysicsStats() const // of the last CPU Simulate with physics on
+    {
+        return physics.GetStats();
+    }
+    bool IsOITUsed() const
+    {
+        return useOIT;
+    }
+    void ToggleSortMode() // cycles Full -> Incremental -> GPU
+    {
+        switch(sortMode)
+        {
+        case SortMode::Full:
+            sortMode = SortMode::Incremental;
+            break;
+        case SortMode::Incremental:
+            sortMode = SortMode::GPU;
+            break;
+        case SortMode::GPU:
+            sortMode = SortMode::Full;
+            break;
+        }
+    }
+    const char* GetSortModeName() const
+    {
+        switch(sortMode)
+        {
+        case SortMode::Full:
+            return "full";
+        case SortMode::Incremental:
+            return "incremental";
+        default:
+            return "GPU";
+        }
     }
     void ToggleTransparentBalls()
     {
-        static bool currState = true;
-        ball.shader.Use();
-        glUniform1i(11, currState = !currState);
+        SetShaderOption(TransparentBallsOption, !shaders.GetValue(shaderKey, TransparentBallsOption));
     }
     void ToggleUsePhong()
     {
-        static bool currState = false;
-        ball.shader.Use();
-        glUniform1i(12, currState = !currState);
+        SetShaderOption(UsePhongOption, !shaders.GetValue(shaderKey, UsePhongOption));
     }
     void ToggleDoWaterOcclusion()
     {
-        static bool currState = true;
-        ball.shader.Use();
-        glUniform1i(13, currState = !currState);
+        doWaterOcclusion = !doWaterOcclusion;
+        SetShaderOption(WaterOcclusionOption, doWaterOcclusion);
+    }
+    void SetLightCount(unsigned int count) // the lights in the light buffer, up to maxPointLights
+    {
+        if(ball.shader.GetID() && count == shaders.GetValue(shaderKey, LightCountOption))
+            return;
+        SetShaderOption(LightCountOption, count);
+    }
+    void PrecompileShaders(unsigned int lightCount) // the current variant with this many lights, the debug toggles compile theirs on first use
+    {
+        shaders.Precompile(shaders.With(shaderKey, LightCountOption, lightCount));
+    }
+    void SetWater(glm::vec3 col, float absorbance) // water colour and absorbance of the ball shaders, which the water culling is derived from
+    {
+        waterCol = col;
+        waterAbsorbance = absorbance;
+        shaders.ForEachCompiled([&](mGLu::Shader &shader){
+            shader.Use();
+            glUniform3f(5, waterCol.x, waterCol.y, waterCol.z);
+            glUniform1f(9, waterAbsorbance);
+        });
+    }
+    // Beyond it the water lets less than waterCullThreshold of a ball's light through, INFINITY if that never happens (a channel
+    // the water does not absorb at all). Only CullInstances() uses it, so it applies to the CPU simulation only.
+    // The default water does not absorb blue, so culling only starts once SetWater() makes it murkier.
+    float WaterCullDistance() const
+    {
+        const glm::vec3 absorbance = waterAbsorbance * (glm::vec3(1.f) - waterCol);
+        const float weakest = std::min({absorbance.x, absorbance.y, absorbance.z}); // the least absorbed channel is the last to fade
+        if(!doWaterOcclusion || weakest <= 0.f || waterCullThreshold <= 0.f)
+            return INFINITY;
+        return std::log(1.f / waterCullThreshold) / weakest;
     }
 };
\ No newline at end of file
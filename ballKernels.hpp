@@ -0,0 +1,93 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Update kernels for the structure of arrays ball storage. The widest instruction set enabled at compile time is used
+// (AVX2 with -mavx2 or -march=native, SSE2 on any x86-64), remaining elements go through the scalar loop.
+
+// posY += deltaY, removeFlags[i] = posY + scale > maxY (with the scale from before the move),
+// scale = initScale * (1 + 0.3 * (posY - minY) / (maxY - minY)). Returns how many balls are flagged for removal.
+inline std::size_t IntegrateBalls(float *posY, float *scale, const float *initScale, std::uint8_t *removeFlags, std::size_t count,
+                                  float deltaY, float minY, float maxY)
+{
+    const float growth = 0.3f / (maxY - minY);
+    std::size_t removeCount = 0, i = 0;
+#if defined(__AVX2__)
+    const __m256 deltaY8 = _mm256_set1_ps(deltaY), minY8 = _mm256_set1_ps(minY), maxY8 = _mm256_set1_ps(maxY);
+    const __m256 growth8 = _mm256_set1_ps(growth), one8 = _mm256_set1_ps(1.f);
+    for(; i + 8 <= count; i += 8)
+    {
+        __m256 y = _mm256_add_ps(_mm256_loadu_ps(posY + i), deltaY8);
+        __m256 s = _mm256_loadu_ps(scale + i);
+        int removeMask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_add_ps(y, s), maxY8, _CMP_GT_OQ));
+        s = _mm256_mul_ps(_mm256_loadu_ps(initScale + i), _mm256_add_ps(one8, _mm256_mul_ps(growth8, _mm256_sub_ps(y, minY8))));
+        _mm256_storeu_ps(posY + i, y);
+        _mm256_storeu_ps(scale + i, s);
+        for(int lane = 0; lane < 8; lane++)
+            removeFlags[i + lane] = (removeMask >> lane) & 1;
+        removeCount += __builtin_popcount(removeMask);
+    }
+#elif defined(__SSE2__)
+    const __m128 deltaY4 = _mm_set1_ps(deltaY), minY4 = _mm_set1_ps(minY), maxY4 = _mm_set1_ps(maxY);
+    const __m128 growth4 = _mm_set1_ps(growth), one4 = _mm_set1_ps(1.f);
+    for(; i + 4 <= count; i += 4)
+    {
+        __m128 y = _mm_add_ps(_mm_loadu_ps(posY + i), deltaY4);
+        __m128 s = _mm_loadu_ps(scale + i);
+        int removeMask = _mm_movemask_ps(_mm_cmpgt_ps(_mm_add_ps(y, s), maxY4));
+        s = _mm_mul_ps(_mm_loadu_ps(initScale + i), _mm_add_ps(one4, _mm_mul_ps(growth4, _mm_sub_ps(y, minY4))));
+        _mm_storeu_ps(posY + i, y);
+        _mm_storeu_ps(scale + i, s);
+        for(int lane = 0; lane < 4; lane++)
+            removeFlags[i + lane] = (removeMask >> lane) & 1;
+        removeCount += __builtin_popcount(removeMask);
+    }
+#endif
+    for(; i < count; i++)
+    {
+        posY[i] += deltaY;
+        removeFlags[i] = posY[i] + scale[i] > maxY;
+        scale[i] = initScale[i] * (1.f + growth * (posY[i] - minY));
+        removeCount += removeFlags[i];
+    }
+    return removeCount;
+}
+
+// keys[i] = distance(pos[i], cameraPos) - scale[i], the back-to-front sort key of a ball
+inline void ComputeDepthKeys(const float *posX, const float *posY, const float *posZ, const float *scale, float *keys, std::size_t count,
+                             float cameraX, float cameraY, float cameraZ)
+{
+    std::size_t i = 0;
+#if defined(__AVX2__)
+    const __m256 cameraX8 = _mm256_set1_ps(cameraX), cameraY8 = _mm256_set1_ps(cameraY), cameraZ8 = _mm256_set1_ps(cameraZ);
+    for(; i + 8 <= count; i += 8)
+    {
+        __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(posX + i), cameraX8);
+        __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(posY + i), cameraY8);
+        __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(posZ + i), cameraZ8);
+        __m256 distSqr = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+        _mm256_storeu_ps(keys + i, _mm256_sub_ps(_mm256_sqrt_ps(distSqr), _mm256_loadu_ps(scale + i)));
+    }
+#elif defined(__SSE2__)
+    const __m128 cameraX4 = _mm_set1_ps(cameraX), cameraY4 = _mm_set1_ps(cameraY), cameraZ4 = _mm_set1_ps(cameraZ);
+    for(; i + 4 <= count; i += 4)
+    {
+        __m128 dx = _mm_sub_ps(_mm_loadu_ps(posX + i), cameraX4);
+        __m128 dy = _mm_sub_ps(_mm_loadu_ps(posY + i), cameraY4);
+        __m128 dz = _mm_sub_ps(_mm_loadu_ps(posZ + i), cameraZ4);
+        __m128 distSqr = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+        _mm_storeu_ps(keys + i, _mm_sub_ps(_mm_sqrt_ps(distSqr), _mm_loadu_ps(scale + i)));
+    }
+#endif
+    for(; i < count; i++)
+    {
+        float dx = posX[i] - cameraX, dy = posY[i] - cameraY, dz = posZ[i] - cameraZ;
+        keys[i] = std::sqrt(dx*dx + dy*dy + dz*dz) - scale[i];
+    }
+}
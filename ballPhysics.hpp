@@ -0,0 +1,157 @@
+#pragma once
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include "ballGrid.hpp"
+
+struct BallPhysicsStats
+{
+    std::size_t candidatePairs = 0; // pairs the grid broadphase handed to the narrowphase
+    std::size_t contactPairs = 0;   // candidates that actually overlapped
+    std::size_t resolvedPairs = 0;  // contacts resolved before maxContacts ran out
+    float milliseconds = 0.f;       // broadphase and contact resolution of the last step
+};
+
+// Optional rigid body motion for the CPU simulated balls: buoyancy against linear drag, sphere contacts between balls
+// and with the side walls of the aquarium. Masses scale with volume. The BallGrid built over the integrated positions is
+// the broadphase, so a step stays O(balls) unless balls pile up far denser than one per cell.
+class BallPhysics
+{
+    struct __contact
+    {
+        unsigned int a, b;
+    };
+    std::vector<std::vector<__contact>> chunkContacts; // one list per grain sized chunk, so gathering needs no locking
+    std::vector<std::size_t> chunkCandidates;
+    std::size_t startChunk = 0; // where resolution begins, the chunk the last step ran out of contacts in
+    BallPhysicsStats stats;
+
+    void Bounce(float &pos, float &vel, float radius, float minBound, float maxBound) const
+    {
+        if(pos - radius < minBound)
+        {
+            pos = minBound + radius;
+            if(vel < 0.f)
+                vel *= -restitution;
+        }
+        else if(pos + radius > maxBound)
+        {
+            pos = maxBound - radius;
+            if(vel > 0.f)
+                vel *= -restitution;
+        }
+    }
+public:
+    struct Streams
+    {
+        float *posX, *posY, *posZ, *velX, *velY, *velZ;
+        const float *scale;
+    };
+    float drag = 2.f;           // 1/s, how quickly balls settle at their rise velocity
+    float restitution = 0.4f;   // bounciness of ball and wall contacts
+    std::size_t maxContacts = 8192; // contacts a step may resolve, the rest is left overlapping until a later step
+
+    // vel += drag * (riseVelocity * up - vel) * deltaTime, solved implicitly so any step size is stable, then pos += vel * deltaTime
+    void Integrate(const Streams &s, std::size_t begin, std::size_t end, float deltaTime, float riseVelocity) const
+    {
+        const float damping = 1.f / (1.f + drag * deltaTime), buoyancy = drag * riseVelocity * deltaTime;
+        for(std::size_t i = begin; i < end; i++)
+        {
+            s.velX[i] *= damping;
+            s.velY[i] = (s.velY[i] + buoyancy) * damping;
+            s.velZ[i] *= damping;
+            s.posX[i] += s.velX[i] * deltaTime;
+            s.posY[i] += s.velY[i] * deltaTime;
+            s.posZ[i] += s.velZ[i] * deltaTime;
+        }
+    }
+    void ConstrainToWalls(const Streams &s, std::size_t begin, std::size_t end, glm::vec3 minBounds, glm::vec3 maxBounds) const // sides only, balls enter below and leave through the top
+    {
+        for(std::size_t i = begin; i < end; i++)
+        {
+            Bounce(s.posX[i], s.velX[i], s.scale[i], minBounds.x, maxBounds.x);
+            Bounce(s.posZ[i], s.velZ[i], s.scale[i], minBounds.z, maxBounds.z);
+        }
+    }
+    // Gathers overlapping pairs from grid (built over s) in parallel, then resolves them one after another on this thread.
+    // The budget is a contact count rather than time so a step depends only on its inputs, and resolution starts where the
+    // last step stopped, so when it runs out it is not always the same balls that stay overlapping.
+    void Collide(const Streams &s, std::size_t count, const BallGrid &grid, mGLu::JobSystem *jobs, std::size_t grainSize)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const std::size_t chunkCount = (count + grainSize - 1) / grainSize;
+        chunkContacts.resize(chunkCount);
+        chunkCandidates.assign(chunkCount, 0);
+        auto gather = [&](std::size_t begin, std::size_t end){
+            for(std::size_t chunk = begin / grainSize; chunk * grainSize < end; chunk++)
+            {
+                std::vector<__contact> &contacts = chunkContacts[chunk];
+                contacts.clear();
+                for(unsigned int i = chunk * grainSize; i < std::min(end, (chunk + 1) * grainSize); i++)
+                    grid.ForEachNearby({s.posX[i], s.posY[i], s.posZ[i]}, s.scale[i], [&](unsigned int j){
+                        if(j <= i) // every pair once
+                            return;
+                        chunkCandidates[chunk]++;
+                        float dx = s.posX[j] - s.posX[i], dy = s.posY[j] - s.posY[i], dz = s.posZ[j] - s.posZ[i];
+                        float reach = s.scale[i] + s.scale[j];
+                        if(dx*dx + dy*dy + dz*dz < reach * reach)
+                            contacts.push_back({i, j});
+                    });
+            }
+        };
+        if(jobs)
+            jobs->ParallelFor(0, count, grainSize, gather);
+        else
+            gather(0, count);
+
+        stats = {};
+        for(std::size_t chunk = 0; chunk < chunkCount; chunk++)
+        {
+            stats.candidatePairs += chunkCandidates[chunk];
+            stats.contactPairs += chunkContacts[chunk].size();
+        }
+        const std::size_t firstChunk = chunkCount ? startChunk % chunkCount : 0;
+        for(std::size_t visited = 0; visited < chunkCount; visited++)
+        {
+            const std::size_t chunk = (firstChunk + visited) % chunkCount;
+            if(stats.resolvedPairs + chunkContacts[chunk].size() > maxContacts)
+            {
+                for(std::size_t i = 0; stats.resolvedPairs < maxContacts; i++, stats.resolvedPairs++)
+                    Resolve(s, chunkContacts[chunk][i].a, chunkContacts[chunk][i].b);
+                startChunk = chunk; // its remaining contacts come first next step
+                break;
+            }
+            for(const __contact &contact : chunkContacts[chunk])
+                Resolve(s, contact.a, contact.b);
+            stats.resolvedPairs += chunkContacts[chunk].size();
+        }
+        stats.milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    void Resolve(const Streams &s, unsigned int a, unsigned int b) const // pushes the pair apart by inverse mass and removes the approaching velocity
+    {
+        glm::vec3 delta(s.posX[b] - s.posX[a], s.posY[b] - s.posY[a], s.posZ[b] - s.posZ[a]);
+        float dist = glm::length(delta);
+        float penetration = s.scale[a] + s.scale[b] - dist;
+        if(penetration <= 0.f) // separated by an earlier contact
+            return;
+        glm::vec3 normal = dist > 1e-6f ? delta / dist : glm::vec3(0.f, 1.f, 0.f);
+        float invMassA = 1.f / (s.scale[a] * s.scale[a] * s.scale[a]), invMassB = 1.f / (s.scale[b] * s.scale[b] * s.scale[b]);
+        float invMassSum = invMassA + invMassB;
+
+        glm::vec3 push = normal * (penetration / invMassSum);
+        s.posX[a] -= push.x * invMassA; s.posY[a] -= push.y * invMassA; s.posZ[a] -= push.z * invMassA;
+        s.posX[b] += push.x * invMassB; s.posY[b] += push.y * invMassB; s.posZ[b] += push.z * invMassB;
+
+        float approach = glm::dot(glm::vec3(s.velX[b] - s.velX[a], s.velY[b] - s.velY[a], s.velZ[b] - s.velZ[a]), normal);
+        if(approach >= 0.f)
+            return;
+        glm::vec3 impulse = normal * (-(1.f + restitution) * approach / invMassSum);
+        s.velX[a] -= impulse.x * invMassA; s.velY[a] -= impulse.y * invMassA; s.velZ[a] -= impulse.z * invMassA;
+        s.velX[b] += impulse.x * invMassB; s.velY[b] += impulse.y * invMassB; s.velZ[b] += impulse.z * invMassB;
+    }
+    const BallPhysicsStats& GetStats() const
+    {
+        return stats;
+    }
+};
@@ -0,0 +1,252 @@
+#pragma once
+#include <vector>
+const char *ballSimCScode = R"DENOM(
+layout(local_size_x = 64) in;
+struct Ball
+{
+    vec3 pos;
+    float scale;
+    float initScale;
+    float colR, colG, colB;
+};
+struct DrawCommand
+{
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+layout(std430, binding = 2) readonly buffer SRC_BALLS
+{
+    Ball srcBalls[];
+};
+layout(std430, binding = 3) writeonly buffer DST_BALLS
+{
+    Ball dstBalls[];
+};
+layout(std430, binding = 4) readonly buffer SPAWNED_BALLS
+{
+    Ball spawnedBalls[];
+};
+layout(std430, binding = 5) buffer DRAW_COMMANDS
+{
+    DrawCommand drawCommands[2]; // drawCommands[i].instanceCount is the ball count of state buffer i
+};
+layout(std430, binding = 6) buffer STATUS
+{
+    uint playerHit;
+};
+
+layout(location = 0) uniform uint srcState;
+layout(location = 1) uniform uint spawnCount;
+layout(location = 2) uniform uint maxBallCount;
+layout(location = 3) uniform vec3 minAquarium;
+layout(location = 4) uniform vec3 maxAquarium;
+layout(location = 5) uniform float ballVelocity;
+layout(location = 6) uniform float deltaTime;
+layout(location = 7) uniform vec3 playerPos;
+layout(location = 8) uniform float playerRadius;
+
+void Append(Ball ball)
+{
+    uint i = atomicAdd(drawCommands[1 - srcState].instanceCount, 1);
+    if(i < maxBallCount)
+        dstBalls[i] = ball;
+    else
+        atomicAdd(drawCommands[1 - srcState].instanceCount, uint(-1)); // the counter settles at maxBallCount once every overflowing append backs out
+}
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if(i < drawCommands[srcState].instanceCount)
+    {
+        Ball ball = srcBalls[i];
+        ball.pos.y += ballVelocity * deltaTime;
+        if(ball.pos.y + ball.scale <= maxAquarium.y)
+        {
+            ball.scale = ball.initScale * (1 + 0.3 * (ball.pos.y - minAquarium.y) / (maxAquarium.y - minAquarium.y));
+            if(distance(ball.pos, playerPos) < playerRadius + ball.scale)
+                atomicOr(playerHit, 1);
+            Append(ball);
+        }
+    }
+    if(i < spawnCount)
+        Append(spawnedBalls[i]);
+}
+)DENOM";
+
+// Keeps ball state in two SSBOs that a compute shader ping-pongs between every frame.
+// Integration, despawning and compaction happen on the GPU, the surviving ball count lands in the
+// instanceCount of a DrawElementsIndirectCommand, so the CPU only ever uploads small spawn batches.
+template<typename Ball>
+class BallSimulationGPU
+{
+    static_assert(sizeof(Ball) == 32, "Ball has to match the std430 layout of Ball in ballSimCScode");
+    struct __DrawCommand
+    {
+        GLuint count, instanceCount, firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+    static constexpr GLuint workGroupSize = 64;
+    static constexpr GLuint maxSpawnBatch = 64;
+    static constexpr GLuint statusSlotCount = 3;   // steps whose player hit result can be in flight at once
+    static constexpr GLsizeiptr statusSlotSize = 256; // a multiple of every GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT
+
+    mGLu::ComputeShader simShader;
+    mGLu::FixedBuffer stateBuffers[2], spawnBuffer, drawCommandBuffer, statusBuffer;
+    const GLuint maxBallCount;
+    GLuint srcState = 0;
+    std::vector<Ball> pendingSpawns;
+    bool playerHit = false;
+    volatile GLuint *statusMapping = nullptr; // persistently mapped, slot i is at statusMapping[i * statusSlotSize / sizeof(GLuint)]
+    GLsync statusFences[statusSlotCount] = {}; // placed after the dispatch that wrote the slot, nullptr once it has been read
+    GLuint statusSlot = 0;   // next slot a step writes to
+    GLuint oldestStatus = 0; // next slot whose result is read
+
+    volatile GLuint& StatusOf(GLuint slot)
+    {
+        return statusMapping[slot * statusSlotSize / sizeof(GLuint)];
+    }
+    bool ReadStatus(GLuint slot, GLuint64 timeout) // false if the dispatch writing the slot has not finished within timeout nanoseconds
+    {
+        GLenum result = glClientWaitSync(statusFences[slot], timeout ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, timeout);
+        if(result == GL_TIMEOUT_EXPIRED || result == GL_WAIT_FAILED)
+            return false;
+        glDeleteSync(statusFences[slot]);
+        statusFences[slot] = nullptr;
+        playerHit = playerHit || StatusOf(slot);
+        StatusOf(slot) = 0;
+        return true;
+    }
+public:
+    BallSimulationGPU(const mGLu::Window &window, GLuint _maxBallCount):
+        simShader(window, ballSimCScode),
+        spawnBuffer(maxSpawnBatch * sizeof(Ball), nullptr, GL_DYNAMIC_STORAGE_BIT),
+        statusBuffer(statusSlotCount * statusSlotSize, nullptr, GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT),
+        maxBallCount(_maxBallCount)
+    {
+        statusMapping = (volatile GLuint*)glMapNamedBufferRange(statusBuffer.GetName(), 0, statusBuffer.GetSize(),
+            GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+        for(GLuint slot = 0; slot < statusSlotCount; slot++)
+            StatusOf(slot) = 0;
+        for(mGLu::FixedBuffer &stateBuffer : stateBuffers)
+            stateBuffer = mGLu::FixedBuffer(maxBallCount * sizeof(Ball), nullptr, GL_DYNAMIC_STORAGE_BIT);
+        __DrawCommand drawCommands[2] = {};
+        drawCommandBuffer = mGLu::FixedBuffer(2, drawCommands, GL_DYNAMIC_STORAGE_BIT);
+    }
+    BallSimulationGPU(const BallSimulationGPU&) = delete;
+    ~BallSimulationGPU()
+    {
+        for(GLsync fence : statusFences)
+            if(fence)
+                glDeleteSync(fence);
+    }
+    void SetMeshIndexCount(GLuint indexCount, GLuint firstIndex = 0) // index range every ball is drawn with
+    {
+        for(GLuint state = 0; state < 2; state++)
+        {
+            glNamedBufferSubData(drawCommandBuffer.GetName(), state * sizeof(__DrawCommand) + offsetof(__DrawCommand, count), sizeof(GLuint), &indexCount);
+            glNamedBufferSubData(drawCommandBuffer.GetName(), state * sizeof(__DrawCommand) + offsetof(__DrawCommand, firstIndex), sizeof(GLuint), &firstIndex);
+        }
+    }
+    void Spawn(const Ball &ball)
+    {
+        pendingSpawns.push_back(ball);
+    }
+    void Step(float deltaTime, float ballVelocity, glm::vec3 minAquarium, glm::vec3 maxAquarium, glm::vec3 playerPos, float playerRadius)
+    {
+        // collects the results of earlier steps whose fences have signalled without waiting on the GPU, only when every slot
+        // is still in flight does the oldest one have to be waited for
+        playerHit = false;
+        for(; statusFences[oldestStatus] && ReadStatus(oldestStatus, 0); oldestStatus = (oldestStatus + 1) % statusSlotCount);
+        if(statusFences[statusSlot])
+        {
+            while(!ReadStatus(statusSlot, 1000000));
+            oldestStatus = (statusSlot + 1) % statusSlotCount;
+        }
+
+        const GLuint dstState = 1 - srcState;
+        glClearNamedBufferSubData(drawCommandBuffer.GetName(), GL_R32UI, dstState * sizeof(__DrawCommand) + offsetof(__DrawCommand, instanceCount), sizeof(GLuint), GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+        GLuint spawnCount = std::min<std::size_t>(pendingSpawns.size(), maxSpawnBatch);
+        if(spawnCount)
+        {
+            glNamedBufferSubData(spawnBuffer.GetName(), 0, spawnCount * sizeof(Ball), pendingSpawns.data());
+            pendingSpawns.erase(pendingSpawns.begin(), pendingSpawns.begin() + spawnCount);
+        }
+
+        stateBuffers[srcState].BindToSSBO(2);
+        stateBuffers[dstState].BindToSSBO(3);
+        spawnBuffer.BindToSSBO(4);
+        drawCommandBuffer.BindToSSBO(5);
+        statusBuffer.BindToSSBO(6, sizeof(GLuint), statusSlot * statusSlotSize);
+
+        simShader.Use();
+        glUniform1ui(0, srcState);
+        glUniform1ui(1, spawnCount);
+        glUniform1ui(2, maxBallCount);
+        glUniform3f(3, minAquarium.x, minAquarium.y, minAquarium.z);
+        glUniform3f(4, maxAquarium.x, maxAquarium.y, maxAquarium.z);
+        glUniform1f(5, ballVelocity);
+        glUniform1f(6, deltaTime);
+        glUniform3f(7, playerPos.x, playerPos.y, playerPos.z);
+        glUniform1f(8, playerRadius);
+        simShader.Dispatch((std::max(maxBallCount, maxSpawnBatch) + workGroupSize - 1) / workGroupSize);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_COMMAND_BARRIER_BIT | GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+        statusFences[statusSlot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        statusSlot = (statusSlot + 1) % statusSlotCount;
+
+        srcState = dstState;
+    }
+    void Upload(const std::vector<Ball> &balls) // replaces the simulated state, used when switching over from the CPU simulation
+    {
+        GLuint count = std::min<std::size_t>(balls.size(), maxBallCount);
+        glNamedBufferSubData(stateBuffers[srcState].GetName(), 0, count * sizeof(Ball), balls.data());
+        glNamedBufferSubData(drawCommandBuffer.GetName(), srcState * sizeof(__DrawCommand) + offsetof(__DrawCommand, instanceCount), sizeof(GLuint), &count);
+        pendingSpawns.clear();
+    }
+    void Download(std::vector<Ball> &balls) // reads the simulated state back, stalls until the GPU is done with it
+    {
+        GLuint count = 0;
+        glGetNamedBufferSubData(drawCommandBuffer.GetName(), srcState * sizeof(__DrawCommand) + offsetof(__DrawCommand, instanceCount), sizeof(GLuint), &count);
+        balls.resize(count);
+        glGetNamedBufferSubData(stateBuffers[srcState].GetName(), 0, count * sizeof(Ball), balls.data());
+        balls.insert(balls.end(), pendingSpawns.begin(), pendingSpawns.end());
+        pendingSpawns.clear();
+    }
+    void Clear()
+    {
+        for(GLuint state = 0; state < 2; state++)
+            glClearNamedBufferSubData(drawCommandBuffer.GetName(), GL_R32UI, state * sizeof(__DrawCommand) + offsetof(__DrawCommand, instanceCount), sizeof(GLuint), GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+        for(GLuint slot = 0; slot < statusSlotCount; slot++) // hits of steps still in flight belong to the balls just removed
+            if(statusFences[slot])
+            {
+                while(!ReadStatus(slot, 1000000));
+            }
+        oldestStatus = statusSlot;
+        pendingSpawns.clear();
+        playerHit = false;
+    }
+    bool PlayerHit() const // true if a ball touched the player in one of the earlier steps whose results the last Step() collected
+    {
+        return playerHit;
+    }
+    mGLu::FixedBuffer& GetStateBuffer()
+    {
+        return stateBuffers[srcState];
+    }
+    mGLu::FixedBuffer& GetDrawCommandBuffer()
+    {
+        return drawCommandBuffer;
+    }
+    GLintptr GetDrawCommandOffset() const
+    {
+        return srcState * sizeof(__DrawCommand);
+    }
+    GLuint GetStateIndex() const // index of the current state's command in DRAW_COMMANDS
+    {
+        return srcState;
+    }
+};
@@ -5,6 +5,7 @@
 #include <unordered_map>
 #include <glm/gtx/transform.hpp>
 
+const unsigned int maxPointLights = 20; // the light shaders are specialized for 0 to maxPointLights lights
 const char *lightBufferPrefixCode = R"DENOM(
 struct PointLight
 {
@@ -26,22 +27,19 @@ layout (std430, binding = 1) buffer LIGHTS
 
 struct __Light_Buffer_Data
 {
-private:
-    static constexpr GLuint __maxLightN = 20;
-public:
     alignas(4) GLuint lightN = 0;
     struct 
     {
         alignas(16)glm::vec3 col;
         alignas(16)glm::vec3 pos;
         alignas(4)float intensity;
-    } lights[__maxLightN];
+    } lights[maxPointLights];
 } lightBufferData;
 
 class MainWindow : public mGLu::Window
 {
     friend class BallHandler;
-    mGLu::FixedBuffer lightsBuffer;
+    mGLu::StagedBuffer lightsBuffer;
     const unsigned int lightCount = 4;
     
     const glm::vec3 aquariumMin = glm::vec3(-25.f, -15.f, -37.5f), aquariumMax = glm::vec3(25.f,15.f, 37.5f);
@@ -72,6 +70,7 @@ class MainWindow : public mGLu::Window
 
     const glm::vec3 startPlayerPos = {0.f,0.f,0.f};
     glm::vec3 playerPos = startPlayerPos;
+    glm::vec3 prevPlayerPos = startPlayerPos, renderPlayerPos = startPlayerPos; // renderPlayerPos is interpolated between the last two ticks
     glm::vec2 playerRot = {0.f,0.f};
     float playerRadius = 0.5f;
     mGLu::Camera mainCamera, secondaryCamera;
@@ -84,11 +83,19 @@ class MainWindow : public mGLu::Window
     
     bool useSecondaryCamera = false;
 
+    const float simulationTickRate = 60.f; // FixedUpdate rate, 0 simulates once per frame instead
+    float nextPhysicsReportTime = 0.f;
+
+    mGLu::JobSystem jobSystem;
+    mGLu::BufferArena meshArena; // vertices and indices of every model share its buffers
+    mGLu::RenderQueue renderQueue;
     BallHandler ballHandler;
     Aquarium aquarium;
     PlayerModel playerModel;
 
     void ProcessInputs();
+    void MovePlayer();
+    void Simulate();
 
     void UpdateCameraMatrix();
 
@@ -120,8 +127,15 @@ class MainWindow : public mGLu::Window
         lightBufferData.lights[2] = {{1.f,1.f,1.f}, {  0.5f, 12.5f,  0.0f}, 600.f};
         lightBufferData.lights[3] = {{1.f,0.f,1.f}, playerPos, 100.f};
         
-        lightsBuffer = mGLu::FixedBuffer(1, &lightBufferData,  GL_DYNAMIC_STORAGE_BIT);
+        for(unsigned int count : {lightCount - 1, lightCount}) // the player light switches between the two in game, so both are compiled before the first frame
+        {
+            aquarium.PrecompileShaders(count);
+            playerModel.PrecompileShaders(count);
+            ballHandler.PrecompileShaders(count);
+        }
+        lightsBuffer = mGLu::StagedBuffer(sizeof(lightBufferData), &lightBufferData);
         lightsBuffer.BindToSSBO(1);
+        UpdateLights();
         
         glClearColor(0.5f, 0.5f, 0.5f, 1.f);
         levelStartTime = GetTime();
@@ -129,46 +143,54 @@ class MainWindow : public mGLu::Window
         glm::vec2 winSize = this->GetSize();
         mainCamera.projection = glm::perspective(FOV, winSize.x/winSize.y, 0.1f, 1000.f);
         secondaryCamera.view = glm::lookAt(glm::vec3(20.f, 30.f, 0.f), glm::vec3(0.f), glm::vec3(0.f, 1.f, 0.f));
+
+        if(simulationTickRate > 0.f)
+            SetFixedTimeStep(1.f/simulationTickRate);
+    }
+    void FixedUpdate()
+    {
+        Simulate();
     }
     void Update()
     {
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        
-        if(useSecondaryCamera)
-            UseCamera(secondaryCamera);
-        else
-            UseCamera(mainCamera);
 
+        if(FixedTimeStep() == 0.f)
+            Simulate();
+        renderPlayerPos = glm::mix(prevPlayerPos, playerPos, FixedAlpha());
+        playerModel.pos = renderPlayerPos;
+
+        UpdateLights();
+        UpdateCameraMatrix(); // before drawing, so ball culling and rendering use the same view
+        mGLu::Camera &camera = useSecondaryCamera ? secondaryCamera : mainCamera;
+        UseCamera(camera);
+        UpdateSharedShaderVars();
         
-        aquarium.Draw();
+        aquarium.Submit(renderQueue);
+        playerModel.Submit(renderQueue, renderPlayerPos);
 
-        playerModel.Draw();
+        ballHandler.Update(renderPlayerPos, camera, FixedAlpha());
+        ballHandler.Submit(renderQueue, renderPlayerPos);
+        renderQueue.Execute();
 
-        ballHandler.Update(playerPos);
-        ballHandler.Draw();
+        if(ballHandler.IsPhysicsUsed() && !ballHandler.IsGPUSimulated() && GetTime() >= nextPhysicsReportTime)
+        {
+            const BallPhysicsStats &stats = ballHandler.GetPhysicsStats();
+            printf("Physics: %zu candidate pairs, %zu contacts, %zu resolved in %.3f ms\n", stats.candidatePairs, stats.contactPairs, stats.resolvedPairs, stats.milliseconds);
+            nextPhysicsReportTime = GetTime() + 1.f;
+        }
 
         ProcessInputs();
 
-        if(CheckPlayerWinLevel())
-            HandlePlayerWinLevel();
-
-        if(CheckPlayerDeath())
-            HandlePlayerDeath();
-        
-        
-        UpdateLights();
-        UpdateCameraMatrix();
-        UpdateSharedShaderVars();
-
     }
 public:
     MainWindow(unsigned int width, unsigned int height, bool fullscreen, unsigned int seed):
         Window(width, height, "title", fullscreen, 4, 3),
         mainCamera(0, 0, width, height),
         secondaryCamera(0, 0, width, height),
-        ballHandler(this, seed, aquariumMin, aquariumMax, minBallDelay, maxBallDelay, 0.3f, 1.f, 2000, 4),
-        aquarium(this, aquariumMin, aquariumMax),
-        playerModel(this, playerRadius, playerPos, glm::vec3(0.f), 4)
+        ballHandler(this, seed, aquariumMin, aquariumMax, minBallDelay, maxBallDelay, 0.3f, 1.f, 2000, meshArena, 4, &jobSystem),
+        aquarium(this, aquariumMin, aquariumMax, meshArena),
+        playerModel(this, playerRadius, playerPos, glm::vec3(0.f), 4, meshArena)
     {
 
     }
@@ -180,6 +202,7 @@ public:
 
 int main()
 {
+    mGLu::Shader::SetBinaryCacheDirectory("shaderCache");
     MainWindow window(2000,900,false, time(nullptr));
     window.StartMainLoop();
     return 0;
@@ -195,15 +218,21 @@ int main()
 
 //  === DEFINITIONS ===
 
-void MainWindow::ProcessInputs()
+void MainWindow::Simulate()
+{
+    prevPlayerPos = playerPos;
+    MovePlayer();
+
+    ballHandler.Simulate(playerPos, playerRadius);
+
+    if(CheckPlayerWinLevel())
+        HandlePlayerWinLevel();
+
+    if(CheckPlayerDeath())
+        HandlePlayerDeath();
+}
+void MainWindow::MovePlayer()
 {
-    if(GetMouseMove() != glm::vec2(0))
-    {
-        playerRot.x += GetMouseMove().y * rotSpeed * mouseSensi;
-        playerRot.y -= GetMouseMove().x * rotSpeed * mouseSensi;
-        if(playerRot.x > 3.1415f/2) playerRot.x = 3.1415f/2;
-        if(playerRot.x < -3.1415f/2) playerRot.x = -3.1415f/2;
-    }
     glm::mat4 rotMat = glm::rotate(playerRot.y, glm::vec3(0.f,1.f,0.f)) * glm::rotate(playerRot.x, glm::vec3(1.f,0.f,0.f));
     if(useSecondaryCamera)
         rotMat = glm::rotate((float)M_PI*0.5f, glm::vec3(0.f,1.f,0.f));
@@ -222,7 +251,18 @@ void MainWindow::ProcessInputs()
     if(KeyInputState(GLFW_KEY_LEFT_SHIFT))
         playerPos-=upVec*moveSpeed*DeltaTime();
 
-    playerModel.pos = playerPos;
+    for(int i = 0; i < 3; i++)
+        playerPos[i] = std::min(std::max(playerPos[i], aquariumMin[i] + playerRadius), aquariumMax[i] - playerRadius);
+}
+void MainWindow::ProcessInputs()
+{
+    if(GetMouseMove() != glm::vec2(0))
+    {
+        playerRot.x += GetMouseMove().y * rotSpeed * mouseSensi;
+        playerRot.y -= GetMouseMove().x * rotSpeed * mouseSensi;
+        if(playerRot.x > 3.1415f/2) playerRot.x = 3.1415f/2;
+        if(playerRot.x < -3.1415f/2) playerRot.x = -3.1415f/2;
+    }
 
     static bool prevFState = false;
     bool currFState = KeyInputState(GLFW_KEY_F);
@@ -242,13 +282,71 @@ void MainWindow::ProcessInputs()
         ballHandler.ToggleTransparentBalls();
     prevTState = currTState;
 
+    static bool prevKState = false;
+    bool currKState = KeyInputState(GLFW_KEY_K);
+    if( currKState && !prevKState)
+    {
+        ballHandler.ToggleSortMode();
+        printf("Ball sort mode: %s\n", ballHandler.GetSortModeName());
+    }
+    prevKState = currKState;
+
+    static bool prevGState = false;
+    bool currGState = KeyInputState(GLFW_KEY_G);
+    if( currGState && !prevGState)
+    {
+        ballHandler.ToggleGPUSimulation();
+        printf("Ball simulation: %s\n", ballHandler.IsGPUSimulated() ? "GPU" : "CPU");
+    }
+    prevGState = currGState;
+
+    static bool prevIState = false;
+    bool currIState = KeyInputState(GLFW_KEY_I);
+    if( currIState && !prevIState)
+    {
+        ballHandler.ToggleOIT();
+        printf("Ball transparency: %s\n", ballHandler.IsOITUsed() ? "weighted blended OIT" : "sorted");
+    }
+    prevIState = currIState;
+
+    static bool prevMState = false;
+    bool currMState = KeyInputState(GLFW_KEY_M);
+    if( currMState && !prevMState)
+    {
+        ballHandler.ToggleGeometry();
+        printf("Ball geometry: %s\n", ballHandler.GetGeometryName());
+    }
+    prevMState = currMState;
+
+    static bool prevHState = false;
+    bool currHState = KeyInputState(GLFW_KEY_H);
+    if( currHState && !prevHState)
+    {
+        ballHandler.TogglePhysics();
+        printf("Ball physics: %s\n", ballHandler.IsPhysicsUsed() ? "on" : "off");
+    }
+    prevHState = currHState;
+
+    static bool prevJState = false;
+    bool currJState = KeyInputState(GLFW_KEY_J);
+    if( currJState && !prevJState)
+    {
+        mGLu::GLStateCounters counters = mGLu::GLState::GetFrameCounters();
+        const mGLu::RenderQueueStats &queueStats = renderQueue.GetStats();
+        printf("GL state changes last frame: %u issued, %u skipped as redundant\n", counters.issued, counters.skipped);
+        printf("Render queue: %u packets in %u draw calls\n", queueStats.packets, queueStats.draws);
+        printf("Light buffer: %zu bytes in %zu uploads since start, %zu bytes in full\n", lightsBuffer.GetUploadedBytes(), lightsBuffer.GetUploadCount(),
+               (std::size_t)lightsBuffer.GetSize());
+    }
+    prevJState = currJState;
+
     static bool prevPState = false;
     bool currPState = KeyInputState(GLFW_KEY_P);
     if( currPState && !prevPState)
     {
         ballHandler.ToggleUsePhong();
         aquarium.ToggleUsePhong();
-        playerModel.usePhong = !playerModel.usePhong;
+        playerModel.ToggleUsePhong();
     }
     prevPState = currPState;
 
@@ -258,7 +356,7 @@ void MainWindow::ProcessInputs()
     {
         ballHandler.ToggleDoWaterOcclusion();
         aquarium.ToggleDoWaterOcclusion();
-        playerModel.doWaterOcclusion = !playerModel.doWaterOcclusion;
+        playerModel.ToggleDoWaterOcclusion();
     }
     prevOState = currOState;
 
@@ -286,14 +384,24 @@ void MainWindow::ProcessInputs()
         useSecondaryCamera = !useSecondaryCamera;
     prevTabState = currTabState;
 
-    for(int i = 0; i < 3; i++)
-        playerPos[i] = std::min(std::max(playerPos[i], aquariumMin[i] + playerRadius), aquariumMax[i] - playerRadius);
+    static bool prevVState = false;
+    bool currVState = KeyInputState(GLFW_KEY_V);
+    if( currVState && !prevVState)
+    {
+        SetFixedTimeStep(FixedTimeStep() > 0.f || simulationTickRate == 0.f ? 0.f : 1.f/simulationTickRate);
+        prevPlayerPos = playerPos;
+        if(FixedTimeStep() > 0.f)
+            printf("Simulation: fixed %g ticks per second\n", simulationTickRate);
+        else
+            printf("Simulation: once per frame\n");
+    }
+    prevVState = currVState;
 }
 void MainWindow::UpdateCameraMatrix()
 {
     mainCamera.view = glm::rotate(playerRot.x, glm::vec3(1.f,0.f,0.f));
     mainCamera.view = glm::rotate(playerRot.y, glm::vec3(0.f,1.f,0.f)) * mainCamera.view;
-    mainCamera.view = glm::translate(playerPos) * mainCamera.view;
+    mainCamera.view = glm::translate(renderPlayerPos) * mainCamera.view;
     mainCamera.view = glm::inverse(mainCamera.view);
 
     glm::vec2 winSize = this->GetSize();
@@ -328,12 +436,9 @@ void MainWindow::HandlePlayerWinLevel()
 }
 bool MainWindow::CheckPlayerDeath()
 {
-    for(auto instance : ballHandler.instanceData)
-    {
-        if(glm::length(playerPos - instance.pos) < playerRadius + instance.scale)
-            return true;
-    }
-    return false;
+    if(ballHandler.IsGPUSimulated())
+        return ballHandler.GPUPlayerHit();
+    return ballHandler.OverlapsSphere(playerPos, playerRadius);
 }
 void MainWindow::HandlePlayerDeath()
 {
@@ -343,16 +448,20 @@ void MainWindow::HandlePlayerDeath()
         std::swap(lightBufferData.lights[0].col, lightBufferData.lights[1].col);
     levelCounter = 1;
     currPointBounty = initPointBounty;
-    playerPos = startPlayerPos;
-    ballHandler.instanceData.clear();
+    playerPos = prevPlayerPos = startPlayerPos;
+    ballHandler.Clear();
 
 }
 void MainWindow::UpdateLights()
 {
-    lightBufferData.lights[lightCount - 1].pos = playerPos;
+    lightBufferData.lights[lightCount - 1].pos = renderPlayerPos;
     lightBufferData.lightN = playerLightOn ? lightCount : lightCount - 1;
+    aquarium.SetLightCount(lightBufferData.lightN);
+    playerModel.SetLightCount(lightBufferData.lightN);
+    ballHandler.SetLightCount(lightBufferData.lightN);
     
     lightBufferData.lights[2].intensity = 600 * mainLightOn;
 
-    lightsBuffer.SetData(0,1, &lightBufferData);
+    lightsBuffer.Write(0, lightBufferData); // only the fields that changed get uploaded
+    lightsBuffer.Flush();
 }
\ No newline at end of file
@@ -1,68 +1,112 @@
 #pragma once
 #include <GL/glew.h>
 #include <cstdio>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <utility>
+#include "handles.hpp"
+#include "glState.hpp"
 namespace mGLu
 {
     class Buffer
     {
-        unsigned int *refCount = nullptr;
+        struct __BufferState
+        {
+            GLuint name = 0;
+            GLsizeiptr size = 0;
+        };
+        static HandleRegistry<__BufferState>& Registry()
+        {
+            static HandleRegistry<__BufferState> registry;
+            return registry;
+        }
+        Handle handle;
+        void Release()
+        {
+            __BufferState released;
+            if(Registry().Release(handle, released))
+            {
+                GLState::ForgetBuffer(released.name);
+                glDeleteBuffers(1, &released.name);
+            }
+            handle = {};
+            name = 0;
+        }
     protected:
-        GLsizeiptr *size = 0;
-        GLuint name = 0;
-        Buffer(GLsizeiptr bufferSize):
-            size(new GLsizeiptr(bufferSize)),
-            refCount(new unsigned int(1))
+        GLuint name = 0; // copy of the registry's, so binding needs no lookup
+        Buffer(GLsizeiptr bufferSize)
         {
-            glCreateBuffers(1, (GLuint*)&name);
+            glCreateBuffers(1, &name);
+            handle = Registry().Create({name, bufferSize});
         };
+        void SetSize(GLsizeiptr bufferSize)
+        {
+            if(__BufferState *state = Registry().Get(handle))
+                state->size = bufferSize;
+        }
     public:
         Buffer()
         {
             
         };
         Buffer(const Buffer& other):
-            size(other.size),
-            name(other.name),
-            refCount(other.refCount)
+            handle(other.handle),
+            name(other.name)
+        {
+            Registry().Retain(handle);
+        }
+        Buffer(Buffer&& other) noexcept:
+            handle(other.handle),
+            name(other.name)
         {
-            if(name)
-                ++(*refCount);
+            other.handle = {};
+            other.name = 0;
         }
         Buffer& operator=(const Buffer& other)
         {
-            if(name && --(*refCount) == 0)
-            {
-                delete refCount;
-                delete size;
-                glDeleteBuffers(1, &name);
-            }
-
-            size = other.size;
-            refCount = other.refCount;
+            Registry().Retain(other.handle); // first, other may hold the last other reference to our own buffer
+            Release();
+            handle = other.handle;
             name = other.name;
-            ++(*refCount);
             return *this;
         }
-        virtual ~Buffer()
+        Buffer& operator=(Buffer&& other) noexcept
         {
-            if(name && --(*refCount) == 0)
+            if(this != &other)
             {
-                delete refCount;
-                delete size;
-                glDeleteBuffers(1, &name);
+                Release();
+                handle = other.handle;
+                name = other.name;
+                other.handle = {};
+                other.name = 0;
             }
+            return *this;
         }
-        inline bool IsDefined()
+        virtual ~Buffer()
+        {
+            Release();
+        }
+        inline bool IsDefined() const
         {
             return name;
         }
-        inline GLuint GetName()
+        inline GLuint GetName() const
         {
             return name;
         }
-        inline GLsizeiptr GetSize()
+        inline GLsizeiptr GetSize() const
+        {
+            const __BufferState *state = Registry().Get(handle);
+            return state ? state->size : 0;
+        }
+        inline Handle GetHandle() const // non-owning reference, IsAlive() tells whether the buffer still exists
         {
-            return *size;
+            return handle;
+        }
+        static bool IsAlive(Handle bufferHandle)
+        {
+            return Registry().IsAlive(bufferHandle);
         }
         bool SetData(GLintptr offset, GLsizeiptr dataSize, const void* data)
         {
@@ -71,7 +115,7 @@ namespace mGLu
                 std::fputs("Buffer: Error: tried setting data where offset + dataSize > size of buffer\n", stderr);
                 return false;
             }
-            glNamedBufferSubData(name, offset, GetSize(), data);
+            glNamedBufferSubData(name, offset, dataSize, data);
             return true;
         }
         template<typename T>
@@ -81,7 +125,7 @@ namespace mGLu
         }
         void BindToSSBO(GLuint bindingIndex, GLsizeiptr _size = 0, GLintptr _offset = 0)
         {
-            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, bindingIndex, name, _offset, _size?_size:*size);
+            GLState::BindShaderStorageBuffer(bindingIndex, name, _offset, _size?_size:GetSize());
         }
     };
     class FixedBuffer : public Buffer
@@ -141,14 +185,292 @@ namespace mGLu
         {
             if(bufferUsage)
                 usage = bufferUsage;
-            glNamedBufferData(name, *size = bufferSize, data, usage);
+            SetSize(bufferSize);
+            glNamedBufferData(name, bufferSize, data, usage);
         }
         template<typename T>
         void ReallocBuffer(unsigned int elemCount, const T* data, GLenum bufferUsage = 0) // if bufferUsage is not specified, earlier one is used
         {
             if(bufferUsage)
                 usage = bufferUsage;
-            glNamedBufferData(name, *size = sizeof(T[elemCount]), (const void*)data, usage);
+            SetSize(sizeof(T[elemCount]));
+            glNamedBufferData(name, sizeof(T[elemCount]), (const void*)data, usage);
+        }
+    };
+    // Persistently mapped buffer split into regionCount regions that are written in turn, so the CPU can fill one region
+    // while the GPU still reads the others. Every frame: BeginWrite(), write through the pointer, then bind/draw using GetOffset().
+    // A fence is placed on a region when the next one is begun, so every command reading it has to be issued by then.
+    class StreamBuffer : public Buffer
+    {
+        static constexpr unsigned int maxRegionCount = 4;
+        struct __StreamState
+        {
+            char *mapping = nullptr;
+            GLsizeiptr regionSize = 0;
+            unsigned int regionCount = 0, currRegion = 0;
+            GLsync fences[maxRegionCount] = {};
+        };
+        static HandleRegistry<__StreamState>& StateRegistry()
+        {
+            static HandleRegistry<__StreamState> registry;
+            return registry;
+        }
+        Handle stateHandle;
+        __StreamState* State() const // nullptr for a default constructed StreamBuffer
+        {
+            return StateRegistry().Get(stateHandle);
+        }
+        void Release()
+        {
+            __StreamState released;
+            if(StateRegistry().Release(stateHandle, released))
+                for(GLsync fence : released.fences)
+                    if(fence)
+                        glDeleteSync(fence);
+            stateHandle = {};
+        }
+        static GLsizeiptr AlignRegionSize(GLsizeiptr regionSize, GLsizeiptr elemSize) // regions have to start at valid SSBO/UBO offsets and whole elements
+        {
+            GLint ssboAlignment = 1, uboAlignment = 1;
+            glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &ssboAlignment);
+            glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uboAlignment);
+            GLsizeiptr alignment = std::max<GLsizeiptr>(std::max(ssboAlignment, uboAlignment), 1);
+            GLsizeiptr step = alignment;
+            while(step % elemSize) // lcm of two small numbers
+                step += alignment;
+            return (regionSize + step - 1) / step * step;
+        }
+    public:
+        StreamBuffer(): Buffer(){}
+        StreamBuffer(GLsizeiptr regionSize, unsigned int regionCount = 3, GLsizeiptr elemSize = 1):
+            Buffer(AlignRegionSize(regionSize, std::max<GLsizeiptr>(elemSize, 1)) * std::min(std::max(regionCount, 1u), maxRegionCount)),
+            stateHandle(StateRegistry().Create({}))
+        {
+            __StreamState *state = State();
+            state->regionCount = std::min(std::max(regionCount, 1u), maxRegionCount);
+            state->regionSize = GetSize() / state->regionCount;
+            state->currRegion = state->regionCount - 1; // so the first BeginWrite() starts at region 0
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glNamedBufferStorage(name, GetSize(), nullptr, flags);
+            state->mapping = (char*)glMapNamedBufferRange(name, 0, GetSize(), flags);
+            if(!state->mapping)
+                std::fputs("StreamBuffer: Error: mapping the buffer failed\n", stderr);
+        }
+        StreamBuffer(const StreamBuffer& other):
+            Buffer(other),
+            stateHandle(other.stateHandle)
+        {
+            StateRegistry().Retain(stateHandle);
+        }
+        StreamBuffer(StreamBuffer&& other) noexcept:
+            Buffer(std::move(other)),
+            stateHandle(other.stateHandle)
+        {
+            other.stateHandle = {};
+        }
+        StreamBuffer& operator=(const StreamBuffer& other)
+        {
+            StateRegistry().Retain(other.stateHandle);
+            Release();
+            Buffer::operator=(other);
+            stateHandle = other.stateHandle;
+            return *this;
+        }
+        StreamBuffer& operator=(StreamBuffer&& other) noexcept
+        {
+            if(this != &other)
+            {
+                Release();
+                stateHandle = other.stateHandle;
+                other.stateHandle = {};
+                Buffer::operator=(std::move(other));
+            }
+            return *this;
+        }
+        ~StreamBuffer()
+        {
+            Release();
+        }
+        void* BeginWrite() // fences the current region, moves on to the next one and waits until the GPU is done reading it
+        {
+            __StreamState *state = State();
+            if(!state || !state->mapping)
+                return nullptr;
+            GLsync &prevFence = state->fences[state->currRegion];
+            if(prevFence)
+                glDeleteSync(prevFence);
+            prevFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+            state->currRegion = (state->currRegion + 1) % state->regionCount;
+            GLsync &fence = state->fences[state->currRegion];
+            if(fence)
+            {
+                GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+                while(result == GL_TIMEOUT_EXPIRED)
+                    result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+                if(result == GL_WAIT_FAILED)
+                    std::fputs("StreamBuffer: Error: waiting for a region failed\n", stderr);
+                glDeleteSync(fence);
+                fence = nullptr;
+            }
+            return state->mapping + GetOffset();
+        }
+        template<typename T>
+        T* BeginWrite()
+        {
+            return (T*)BeginWrite();
+        }
+        inline GLintptr GetOffset() const // byte offset of the region last returned by BeginWrite()
+        {
+            const __StreamState *state = State();
+            return state ? state->currRegion * state->regionSize : 0;
+        }
+        inline GLsizeiptr GetRegionSize() const
+        {
+            const __StreamState *state = State();
+            return state ? state->regionSize : 0;
+        }
+        void BindRegionToSSBO(GLuint bindingIndex)
+        {
+            BindToSSBO(bindingIndex, GetRegionSize(), GetOffset());
+        }
+    };
+    // Buffer with a CPU shadow copy. Write() only updates the shadow and records the byte ranges that actually changed,
+    // Flush() merges them and uploads them with as few glNamedBufferSubData calls as possible. Flush before the GPU reads it,
+    // and write through Write() only, SetData() would bypass the shadow.
+    class StagedBuffer : public Buffer
+    {
+        static constexpr GLsizeiptr mergeGap = 64; // clean bytes between two dirty ranges that are cheaper to resend than a second call
+        struct __StagingState
+        {
+            std::vector<char> shadow;
+            std::vector<std::pair<GLintptr, GLintptr>> dirty; // [begin, end) byte ranges in write order, merged on Flush()
+            std::size_t uploadedBytes = 0, uploadCount = 0;
+        };
+        static HandleRegistry<__StagingState>& StateRegistry()
+        {
+            static HandleRegistry<__StagingState> registry;
+            return registry;
+        }
+        Handle stateHandle;
+        __StagingState* State() const
+        {
+            return StateRegistry().Get(stateHandle);
+        }
+        void Release()
+        {
+            __StagingState released;
+            StateRegistry().Release(stateHandle, released);
+            stateHandle = {};
+        }
+    public:
+        StagedBuffer(): Buffer(){}
+        StagedBuffer(GLsizeiptr bufferSize, const void* data = nullptr):
+            Buffer(bufferSize),
+            stateHandle(StateRegistry().Create({}))
+        {
+            __StagingState *state = State();
+            state->shadow.assign(bufferSize, 0);
+            if(data)
+                std::memcpy(state->shadow.data(), data, bufferSize);
+            glNamedBufferStorage(name, GetSize(), state->shadow.data(), GL_DYNAMIC_STORAGE_BIT);
+        }
+        StagedBuffer(const StagedBuffer& other):
+            Buffer(other),
+            stateHandle(other.stateHandle)
+        {
+            StateRegistry().Retain(stateHandle);
+        }
+        StagedBuffer(StagedBuffer&& other) noexcept:
+            Buffer(std::move(other)),
+            stateHandle(other.stateHandle)
+        {
+            other.stateHandle = {};
+        }
+        StagedBuffer& operator=(const StagedBuffer& other)
+        {
+            StateRegistry().Retain(other.stateHandle);
+            Release();
+            Buffer::operator=(other);
+            stateHandle = other.stateHandle;
+            return *this;
+        }
+        StagedBuffer& operator=(StagedBuffer&& other) noexcept
+        {
+            if(this != &other)
+            {
+                Release();
+                stateHandle = other.stateHandle;
+                other.stateHandle = {};
+                Buffer::operator=(std::move(other));
+            }
+            return *this;
+        }
+        ~StagedBuffer()
+        {
+            Release();
+        }
+        bool Write(GLintptr offset, GLsizeiptr dataSize, const void* data)
+        {
+            __StagingState *state = State();
+            if(!state || GetSize() < offset + dataSize)
+            {
+                std::fputs("StagedBuffer: Error: tried writing data where offset + dataSize > size of buffer\n", stderr);
+                return false;
+            }
+            const char *src = (const char*)data;
+            char *dst = state->shadow.data() + offset;
+            GLsizeiptr first = 0, last = dataSize; // trim what did not change, so rewriting a whole struct only sends the fields that did
+            while(first < last && dst[first] == src[first])
+                ++first;
+            while(last > first && dst[last - 1] == src[last - 1])
+                --last;
+            if(first == last)
+                return true;
+            std::memcpy(dst + first, src + first, last - first);
+            state->dirty.push_back({offset + first, offset + last});
+            return true;
+        }
+        template<typename T>
+        bool Write(GLintptr offset, const T &value)
+        {
+            return Write(offset, sizeof(T), (const void*)&value);
+        }
+        void Flush()
+        {
+            __StagingState *state = State();
+            if(!state || state->dirty.empty())
+                return;
+            std::vector<std::pair<GLintptr, GLintptr>> &dirty = state->dirty;
+            std::sort(dirty.begin(), dirty.end());
+            GLintptr begin = dirty[0].first, end = dirty[0].second;
+            for(std::size_t i = 1; i <= dirty.size(); i++)
+            {
+                if(i < dirty.size() && dirty[i].first <= end + mergeGap)
+                {
+                    end = std::max(end, dirty[i].second);
+                    continue;
+                }
+                glNamedBufferSubData(name, begin, end - begin, state->shadow.data() + begin);
+                state->uploadedBytes += end - begin;
+                ++state->uploadCount;
+                if(i < dirty.size())
+                {
+                    begin = dirty[i].first;
+                    end = dirty[i].second;
+                }
+            }
+            dirty.clear();
+        }
+        inline std::size_t GetUploadedBytes() const // sent to the GPU since creation
+        {
+            const __StagingState *state = State();
+            return state ? state->uploadedBytes : 0;
+        }
+        inline std::size_t GetUploadCount() const
+        {
+            const __StagingState *state = State();
+            return state ? state->uploadCount : 0;
         }
     };
 }
\ No newline at end of file
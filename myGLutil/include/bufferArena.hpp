@@ -0,0 +1,50 @@
+#pragma once
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include "buffer.hpp"
+namespace mGLu
+{
+    struct BufferRange // bytes [offset, offset + size) of buffer
+    {
+        FixedBuffer buffer;
+        GLintptr offset = 0;
+        GLsizeiptr size = 0;
+        bool IsValid() const { return size != 0; }
+    };
+    // Suballocates ranges of a few large immutable buffers with a buddy allocator. Every range starts at a multiple of its
+    // power of two block size and at least minBlockSize, so it is a valid vertex, index, SSBO and UBO offset.
+    // Freed blocks are merged with their buddies again. Requests bigger than blockSize get a block of their own.
+    class BufferArena
+    {
+        struct __block
+        {
+            FixedBuffer buffer;
+            unsigned int maxOrder; // the whole buffer is one block of this order
+            std::vector<std::set<GLintptr>> freeBlocks; // offsets of the free blocks of each order
+            std::unordered_map<GLintptr, unsigned int> allocatedOrder;
+        };
+        std::vector<__block> blocks;
+        const GLsizeiptr blockSize, minBlockSize;
+        GLsizeiptr allocatedBytes = 0;
+
+        unsigned int OrderOf(GLsizeiptr size) const; // smallest order whose blocks fit size
+        GLsizeiptr BlockBytes(unsigned int order) const { return minBlockSize << order; }
+        void AddBlock(unsigned int maxOrder);
+        bool AllocateFrom(__block &block, unsigned int order, GLintptr &offset);
+    public:
+        BufferArena(GLsizeiptr blockSize = 1 << 22, GLsizeiptr minBlockSize = 256); // both are rounded up to powers of two
+        BufferArena(const BufferArena&) = delete;
+
+        BufferRange Allocate(GLsizeiptr size, const void* data = nullptr); // data, if given, is uploaded into the range
+        template<typename T>
+        BufferRange Allocate(unsigned int elemCount, const T* data)
+        {
+            return Allocate(sizeof(T) * elemCount, (const void*)data);
+        }
+        void Free(const BufferRange &range);
+
+        GLsizeiptr GetAllocatedBytes() const { return allocatedBytes; } // including the rounding up to block sizes
+        unsigned int GetBufferCount() const { return blocks.size(); }
+    };
+}
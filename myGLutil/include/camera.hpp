@@ -3,6 +3,18 @@
 #include "window.hpp"
 namespace mGLu
 {
+    struct Frustum
+    {
+        glm::vec4 planes[6]; // left, right, bottom, top, near, far with inward facing unit normals, p is inside a plane if dot(xyz, p) + w >= 0
+        Frustum(const glm::mat4 &viewProjection);
+        bool IntersectsSphere(glm::vec3 center, float radius) const // conservative, spheres near the corners may pass
+        {
+            for(const glm::vec4 &plane : planes)
+                if(glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+                    return false;
+            return true;
+        }
+    };
     class Camera
     {
     private:
@@ -16,8 +28,9 @@ namespace mGLu
         Camera(const Camera&) = delete;
         void SetSize(int width, int height);
         void SetOffset(int xOffset, int yOffset);
-        glm::ivec2 GetSize() { return {width, height}; }
+        glm::ivec2 GetSize() const { return {width, height}; }
         float GetRatio() { return (float)width/height; }
+        Frustum GetFrustum() const { return Frustum(projection * view); }
         GLuint GetColorTexture();
         GLuint GetDepthTexture();
         GLuint GetNormalTexture();
@@ -9,11 +9,14 @@ namespace mGLu
         return &t;
     }*/
 
-    constexpr const char* GetGLSLtype(unsigned int size, GLenum type)
+    constexpr const char* GetGLSLtype(unsigned int size, GLenum type, bool normalized = false) // normalized integers read as floats
     {
+        if(normalized)
+            type = GL_FLOAT;
         switch(type)
         {
         case GL_FIXED:
+        case GL_HALF_FLOAT:
         case GL_FLOAT:
             switch(size)
             {
@@ -2,6 +2,8 @@
 #include "shader.hpp"
 #include "buffer.hpp"
 #include "vao.hpp"
+#include "bufferArena.hpp"
+#include "glState.hpp"
 #include <vector>
 typedef unsigned long long ull;
 namespace mGLu
@@ -82,6 +84,14 @@ namespace mGLu
 		}
 		indices = newIndices;
 	}
+	struct DrawElementsIndirectCommand
+	{
+		GLuint count;
+		GLuint instanceCount;
+		GLuint firstIndex;
+		GLint baseVertex;
+		GLuint baseInstance;
+	};
 	class Drawable
 	{
 		struct BufferBinding
@@ -91,6 +101,8 @@ namespace mGLu
 			GLsizei stride; 			// distance between attribs we bind to
 		};
 		std::vector<BufferBinding> bindingData; // we store binding data for binding point i in bindingData[i]
+		FixedBuffer pullLayout; // byte offset and stride of every binding, for VAOs that pull vertices
+		bool pullLayoutDirty = true;
 		GLsizei InferVertexCount() // infers amout of vertices to render based on attrib strides and buffer sizes of defined, non empty buffers
 		{
 			unsigned int vertexCount;
@@ -120,7 +132,7 @@ namespace mGLu
 				indexTypeSize =  sizeof(GLubyte);
 				break;
 			}
-			return indexBuffer.GetSize() / indexTypeSize;
+			return (indexRangeSize ? indexRangeSize : indexBuffer.GetSize()) / indexTypeSize;
 		}
 		void UpdateBindingsSize()
 		{
@@ -130,28 +142,65 @@ namespace mGLu
 		}
 		void BindToVAO()
 		{
+			if(vao.IsPulling())
+			{
+				BindPulledBuffers();
+				return;
+			}
 			for(GLuint bindingI = 0; bindingI < bindingData.size(); bindingI++)
 			{
 				vao.BindBufferToAttrib(bindingI, buffers[bindingData[bindingI].bufferIndex].GetName(), bindingData[bindingI].offset, bindingData[bindingI].stride);
 			}
 		}
+		void BindPulledBuffers() // whole buffers as SSBOs, where the attributes start in them goes into pullLayout
+		{
+			if(pullLayoutDirty)
+			{
+				std::vector<GLuint> layout;
+				for(const BufferBinding &binding : bindingData)
+				{
+					layout.push_back(binding.offset);
+					layout.push_back(binding.stride);
+				}
+				if(!layout.empty())
+					pullLayout = FixedBuffer(layout.size(), layout.data());
+				pullLayoutDirty = false;
+			}
+			if(pullLayout.IsDefined())
+				GLState::BindShaderStorageBuffer(VAOview::pullLayoutBinding, pullLayout.GetName(), 0, pullLayout.GetSize());
+			for(GLuint bindingI = 0; bindingI < bindingData.size(); bindingI++)
+			{
+				const Buffer &buffer = buffers[bindingData[bindingI].bufferIndex];
+				GLState::BindShaderStorageBuffer(VAOview::pullLayoutBinding + 1 + bindingI, buffer.GetName(), 0, buffer.GetSize());
+			}
+		}
+		unsigned int BufferIndexOf(const BufferRange &range) // adds the range's buffer unless it already is in buffers
+		{
+			unsigned int bufferIndex = 0;
+			while(bufferIndex < buffers.size() && buffers[bufferIndex].GetName() != range.buffer.GetName())
+				++bufferIndex;
+			if(bufferIndex == buffers.size())
+				buffers.push_back(range.buffer);
+			return bufferIndex;
+		}
+		void SetPatchVertices(GLenum draw_mode)
+		{
+			if(draw_mode == GL_PATCHES)
+				GLState::PatchVertices(patchVertices);
+		}
 	public:
 		VAOview vao;
 		std::vector<Buffer> buffers;
 		Buffer indexBuffer;
 		Shader shader;
+		GLint patchVertices = 3; // vertices per patch of GL_PATCHES draws
+		GLintptr indexOffset = 0; // where the indices start in indexBuffer, indirect draws have to include it in their firstIndex instead
+		GLsizeiptr indexRangeSize = 0; // 0 means all of indexBuffer
 		Drawable()
 		{
 			
 		}
-		Drawable(const Drawable& other): 
-			bindingData(other.bindingData),
-			vao(other.vao),
-			buffers(other.buffers),
-			indexBuffer(other.indexBuffer)
-		{
-
-		}
+		Drawable(const Drawable& other) = default; // buffers, VAO and shader are shared handles, the copy draws exactly like other
 		bool SetBinding(GLuint bindingPoint, unsigned int bufferIndex, GLintptr offset, GLsizei stride)
 		{
 			UpdateBindingsSize();
@@ -161,6 +210,45 @@ namespace mGLu
 				return false;
 			}
 			bindingData[bindingPoint] = {(int)bufferIndex, offset, stride};
+			pullLayoutDirty = true;
+			return true;
+		}
+		bool SetBinding(GLuint bindingPoint, const BufferRange &range, GLintptr offset, GLsizei stride) // offset is relative to the range, its buffer is added to buffers unless it already is in there
+		{
+			return SetBinding(bindingPoint, BufferIndexOf(range), range.offset + offset, stride);
+		}
+		template<typename Format, typename Layout>
+		bool SetBindings(unsigned int bufferIndex, GLintptr offset = 0) // every attribute of Layout (a VertexLayout in Format), interleaved in buffers[bufferIndex] from offset on
+		{
+			bool success = true;
+			for(GLuint i = 0; i < Layout::attribCount; i++)
+				success &= SetBinding(Format::template FirstBinding<Layout>() + i, bufferIndex, offset + Layout::attribOffsets[i], Layout::stride);
+			return success;
+		}
+		template<typename Format, typename Layout>
+		bool SetBindings(const BufferRange &range, GLintptr offset = 0)
+		{
+			return SetBindings<Format, Layout>(BufferIndexOf(range), range.offset + offset);
+		}
+		void SetIndexBuffer(const BufferRange &range)
+		{
+			indexBuffer = range.buffer;
+			indexOffset = range.offset;
+			indexRangeSize = range.size;
+		}
+		bool SharesStateWith(const Drawable &other) const // same shader, VAO, index buffer and vertex buffers at the same offsets, so one multi draw can carry both drawables' commands
+		{
+			if(shader.GetID() != other.shader.GetID() || vao.GetName() != other.vao.GetName() || indexBuffer.GetName() != other.indexBuffer.GetName()
+				|| patchVertices != other.patchVertices || bindingData.size() != other.bindingData.size())
+				return false;
+			for(std::size_t bindingI = 0; bindingI < bindingData.size(); bindingI++)
+			{
+				const BufferBinding &a = bindingData[bindingI], &b = other.bindingData[bindingI];
+				if((a.bufferIndex == -1) != (b.bufferIndex == -1))
+					return false;
+				if(a.bufferIndex != -1 && (a.offset != b.offset || a.stride != b.stride || buffers[a.bufferIndex].GetName() != other.buffers[b.bufferIndex].GetName()))
+					return false;
+			}
 			return true;
 		}
 		void Draw(GLsizei vertexCount = 0, GLsizei firstVertex = 0, GLenum draw_mode = GL_TRIANGLES) // if vertexCount is not passed it will be infered from attrib strides and sizes of buffers (which has some overhead)
@@ -168,8 +256,9 @@ namespace mGLu
 			BindToVAO();
 			
 			shader.Use();
+			SetPatchVertices(draw_mode);
 
-			glBindVertexArray(vao.GetName());
+			GLState::BindVertexArray(vao.GetName());
 			glDrawArrays(draw_mode, firstVertex, vertexCount?vertexCount : InferVertexCount());
 		}
 		void DrawIndexed(GLsizei indexCount = 0, GLenum draw_mode = GL_TRIANGLES, GLenum indexType = GL_UNSIGNED_INT) // if indexCount is not provided it is infered
@@ -178,17 +267,19 @@ namespace mGLu
 			
 			vao.BindElementBuffer(indexBuffer.GetName());
 			shader.Use();
+			SetPatchVertices(draw_mode);
 
-			glBindVertexArray(vao.GetName());
-			glDrawElements(draw_mode, indexCount ? indexCount : InferIndexCount(indexType), indexType, nullptr);
+			GLState::BindVertexArray(vao.GetName());
+			glDrawElements(draw_mode, indexCount ? indexCount : InferIndexCount(indexType), indexType, (const void*)indexOffset);
 		}
 		void DrawInstanced(GLsizei instanceCount, GLsizei vertexCount = 0, GLsizei firstVertex = 0, GLenum draw_mode = GL_TRIANGLES) // if vertexCount is not passed it will be infered from attrib strides and sizes of buffers (which has some overhead)
 		{
 			BindToVAO();
 			
 			shader.Use();
+			SetPatchVertices(draw_mode);
 
-			glBindVertexArray(vao.GetName());
+			GLState::BindVertexArray(vao.GetName());
 			glDrawArraysInstanced(draw_mode, firstVertex, vertexCount?vertexCount : InferVertexCount(), instanceCount);
 		}
 		void DrawIndexedInstanced(GLsizei instanceCount, GLsizei indexCount = 0, GLenum draw_mode = GL_TRIANGLES, GLenum indexType = GL_UNSIGNED_INT) // if indexCount is not provided it is infered
@@ -197,9 +288,45 @@ namespace mGLu
 			
 			vao.BindElementBuffer(indexBuffer.GetName());
 			shader.Use();
+			SetPatchVertices(draw_mode);
+
+			GLState::BindVertexArray(vao.GetName());
+			glDrawElementsInstanced(draw_mode, indexCount ? indexCount : InferIndexCount(indexType), indexType, (const void*)indexOffset, instanceCount);
+		}
+		void DrawIndexedInstancedBaseInstance(GLsizei instanceCount, GLuint baseInstance, GLsizei indexCount = 0, GLenum draw_mode = GL_TRIANGLES, GLenum indexType = GL_UNSIGNED_INT) // instanced attributes are read starting at element baseInstance, e.g. the current region of a StreamBuffer
+		{
+			BindToVAO();
+			
+			vao.BindElementBuffer(indexBuffer.GetName());
+			shader.Use();
+			SetPatchVertices(draw_mode);
+
+			GLState::BindVertexArray(vao.GetName());
+			glDrawElementsInstancedBaseInstance(draw_mode, indexCount ? indexCount : InferIndexCount(indexType), indexType, (const void*)indexOffset, instanceCount, baseInstance);
+		}
+		void DrawIndexedIndirect(Buffer &commandBuffer, GLintptr commandOffset = 0, GLenum draw_mode = GL_TRIANGLES, GLenum indexType = GL_UNSIGNED_INT) // draw parameters are read from a DrawElementsIndirectCommand at commandOffset, which may be written by the GPU
+		{
+			BindToVAO();
+			
+			vao.BindElementBuffer(indexBuffer.GetName());
+			shader.Use();
+			SetPatchVertices(draw_mode);
+
+			GLState::BindVertexArray(vao.GetName());
+			GLState::BindDrawIndirectBuffer(commandBuffer.GetName());
+			glDrawElementsIndirect(draw_mode, indexType, (const void*)commandOffset);
+		}
+		void MultiDrawIndexedIndirect(Buffer &commandBuffer, GLsizei drawCount, GLintptr commandOffset = 0, GLsizei stride = 0, GLenum draw_mode = GL_TRIANGLES, GLenum indexType = GL_UNSIGNED_INT) // drawCount DrawElementsIndirectCommands starting at commandOffset, stride 0 means tightly packed
+		{
+			BindToVAO();
+			
+			vao.BindElementBuffer(indexBuffer.GetName());
+			shader.Use();
+			SetPatchVertices(draw_mode);
 
-			glBindVertexArray(vao.GetName());
-			glDrawElementsInstanced(draw_mode, indexCount ? indexCount : InferIndexCount(indexType), indexType, nullptr, instanceCount);
+			GLState::BindVertexArray(vao.GetName());
+			GLState::BindDrawIndirectBuffer(commandBuffer.GetName());
+			glMultiDrawElementsIndirect(draw_mode, indexType, (const void*)commandOffset, drawCount, stride);
 		}
 	};
 }
\ No newline at end of file
@@ -0,0 +1,219 @@
+#pragma once
+#include <GL/glew.h>
+#include <vector>
+namespace mGLu
+{
+    struct GLStateCounters
+    {
+        unsigned int issued = 0;  // state changes that reached GL
+        unsigned int skipped = 0; // redundant ones that were dropped
+    };
+    // Shadow of the GL state myGLutil sets on this thread's context, so setting what is already set costs a compare
+    // instead of a driver call. State changed with raw GL calls behind its back has to be Invalidate()d.
+    class GLState
+    {
+        static constexpr GLuint unknown = ~0u;
+        static constexpr GLuint maxCachedBindings = 16; // vertex buffer binding points tracked per VAO, higher ones are always issued
+        static constexpr GLuint maxCachedStorageBindings = 32;
+        static constexpr GLuint maxCachedVAOs = 256; // VAO names are handed out small and dense, bindings of higher ones are always issued
+        struct __vertexBinding
+        {
+            GLuint buffer = unknown;
+            GLintptr offset = 0;
+            GLsizei stride = 0;
+        };
+        struct __rangeBinding
+        {
+            GLuint buffer = unknown;
+            GLintptr offset = 0;
+            GLsizeiptr size = 0;
+        };
+        struct __vaoState // vertex buffer and element buffer bindings live in the VAO, not in the context
+        {
+            GLuint elementBuffer = unknown;
+            __vertexBinding bindings[maxCachedBindings];
+        };
+        struct __state
+        {
+            GLuint program = unknown, vao = unknown, drawFramebuffer = unknown, readFramebuffer = unknown, indirectBuffer = unknown;
+            GLint patchVertices = -1;
+            GLint viewport[4] = {-1, -1, -1, -1}, scissor[4] = {-1, -1, -1, -1};
+            std::vector<__vaoState> vaos; // indexed by name, grown on first use
+            __rangeBinding storageBindings[maxCachedStorageBindings];
+            GLStateCounters frame, lastFrame;
+        };
+        static __state& State()
+        {
+            static thread_local __state state;
+            return state;
+        }
+        static bool Differs(bool differs) // counts the call, true if it has to be issued
+        {
+            GLStateCounters &counters = State().frame;
+            ++(differs ? counters.issued : counters.skipped);
+            return differs;
+        }
+        static __vaoState* VAOState(GLuint vao) // nullptr if vao is not tracked
+        {
+            if(vao >= maxCachedVAOs)
+                return nullptr;
+            std::vector<__vaoState> &vaos = State().vaos;
+            if(vao >= vaos.size())
+                vaos.resize(vao + 1);
+            return &vaos[vao];
+        }
+        static bool RectDiffers(GLint (&cached)[4], GLint x, GLint y, GLsizei width, GLsizei height)
+        {
+            if(!Differs(cached[0] != x || cached[1] != y || cached[2] != width || cached[3] != height))
+                return false;
+            cached[0] = x; cached[1] = y; cached[2] = width; cached[3] = height;
+            return true;
+        }
+    public:
+        static void UseProgram(GLuint program)
+        {
+            if(Differs(State().program != program))
+                glUseProgram(State().program = program);
+        }
+        static GLuint GetProgram() // the program in use, asks GL once if it is not known
+        {
+            if(State().program == unknown)
+            {
+                GLint program = 0;
+                glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+                State().program = program;
+            }
+            return State().program;
+        }
+        static void BindVertexArray(GLuint vao)
+        {
+            if(Differs(State().vao != vao))
+                glBindVertexArray(State().vao = vao);
+        }
+        static void VertexArrayVertexBuffer(GLuint vao, GLuint bindingIndex, GLuint buffer, GLintptr offset, GLsizei stride)
+        {
+            __vaoState *vaoState = VAOState(vao);
+            if(vaoState && bindingIndex < maxCachedBindings)
+            {
+                __vertexBinding &binding = vaoState->bindings[bindingIndex];
+                if(!Differs(binding.buffer != buffer || binding.offset != offset || binding.stride != stride))
+                    return;
+                binding = {buffer, offset, stride};
+            }
+            else
+                Differs(true);
+            glVertexArrayVertexBuffer(vao, bindingIndex, buffer, offset, stride);
+        }
+        static void VertexArrayElementBuffer(GLuint vao, GLuint buffer)
+        {
+            __vaoState *vaoState = VAOState(vao);
+            if(!vaoState)
+            {
+                Differs(true);
+                glVertexArrayElementBuffer(vao, buffer);
+            }
+            else if(Differs(vaoState->elementBuffer != buffer))
+                glVertexArrayElementBuffer(vao, vaoState->elementBuffer = buffer);
+        }
+        static void BindFramebuffer(GLuint framebuffer) // GL_FRAMEBUFFER, so both draw and read
+        {
+            __state &state = State();
+            if(Differs(state.drawFramebuffer != framebuffer || state.readFramebuffer != framebuffer))
+                glBindFramebuffer(GL_FRAMEBUFFER, state.drawFramebuffer = state.readFramebuffer = framebuffer);
+        }
+        static void BindDrawFramebuffer(GLuint framebuffer)
+        {
+            if(Differs(State().drawFramebuffer != framebuffer))
+                glBindFramebuffer(GL_DRAW_FRAMEBUFFER, State().drawFramebuffer = framebuffer);
+        }
+        static void BindDrawIndirectBuffer(GLuint buffer)
+        {
+            if(Differs(State().indirectBuffer != buffer))
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, State().indirectBuffer = buffer);
+        }
+        static void BindShaderStorageBuffer(GLuint bindingIndex, GLuint buffer, GLintptr offset, GLsizeiptr size)
+        {
+            if(bindingIndex < maxCachedStorageBindings)
+            {
+                __rangeBinding &binding = State().storageBindings[bindingIndex];
+                if(!Differs(binding.buffer != buffer || binding.offset != offset || binding.size != size))
+                    return;
+                binding = {buffer, offset, size};
+            }
+            else
+                Differs(true);
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, bindingIndex, buffer, offset, size);
+        }
+        static void PatchVertices(GLint vertices)
+        {
+            if(Differs(State().patchVertices != vertices))
+                glPatchParameteri(GL_PATCH_VERTICES, State().patchVertices = vertices);
+        }
+        static void Viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+        {
+            if(RectDiffers(State().viewport, x, y, width, height))
+                glViewport(x, y, width, height);
+        }
+        static void Scissor(GLint x, GLint y, GLsizei width, GLsizei height)
+        {
+            if(RectDiffers(State().scissor, x, y, width, height))
+                glScissor(x, y, width, height);
+        }
+
+        // names are reused after deletion, so deleting an object has to drop everything cached about it
+        static void ForgetProgram(GLuint program)
+        {
+            if(State().program == program)
+                State().program = unknown;
+        }
+        static void ForgetVertexArray(GLuint vao)
+        {
+            if(vao < State().vaos.size())
+                State().vaos[vao] = {};
+            if(State().vao == vao)
+                State().vao = unknown;
+        }
+        static void ForgetBuffer(GLuint buffer)
+        {
+            __state &state = State();
+            if(state.indirectBuffer == buffer)
+                state.indirectBuffer = unknown;
+            for(__rangeBinding &binding : state.storageBindings)
+                if(binding.buffer == buffer)
+                    binding.buffer = unknown;
+            for(__vaoState &vaoState : state.vaos)
+            {
+                if(vaoState.elementBuffer == buffer)
+                    vaoState.elementBuffer = unknown;
+                for(__vertexBinding &binding : vaoState.bindings)
+                    if(binding.buffer == buffer)
+                        binding.buffer = unknown;
+            }
+        }
+        static void ForgetFramebuffer(GLuint framebuffer)
+        {
+            if(State().drawFramebuffer == framebuffer)
+                State().drawFramebuffer = unknown;
+            if(State().readFramebuffer == framebuffer)
+                State().readFramebuffer = unknown;
+        }
+        static void Invalidate() // after raw GL calls that may have changed any of the tracked state
+        {
+            __state &state = State();
+            GLStateCounters frame = state.frame, lastFrame = state.lastFrame;
+            state = {};
+            state.frame = frame;
+            state.lastFrame = lastFrame;
+        }
+
+        static void EndFrame() // called by the Window once per frame
+        {
+            State().lastFrame = State().frame;
+            State().frame = {};
+        }
+        static GLStateCounters GetFrameCounters() // of the last completed frame
+        {
+            return State().lastFrame;
+        }
+    };
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <vector>
+#include "buffer.hpp"
+namespace mGLu
+{
+    class Window;
+    // Bitonic key/value sort running in compute shaders. Keys are floats, values are usually indices into an instance SSBO.
+    // Usage: Reset(), write KeyValues into the buffer bound by BindKeyValues() with a compute shader of your own,
+    // Sort(), then Gather() the instances into draw order.
+    class GPUSorter
+    {
+    public:
+        struct KeyValue
+        {
+            float key;
+            GLuint value;
+        };
+        static constexpr GLuint padValue = 0xFFFFFFFF; // value of slots that were not written after Reset(), they always sort to the end
+        const bool descending;
+        bool validate = false; // reads every Sort() result back and reports errors to stderr, meant for tests
+
+        GPUSorter(const Window &window, GLuint maxElementCount, bool descending = false, GLuint firstBindingIndex = 8); // uses SSBO binding points firstBindingIndex to firstBindingIndex + 2
+        GPUSorter(const GPUSorter&) = delete;
+        void Reset();
+        void BindKeyValues(GLuint bindingIndex);
+        void Sort();
+        void Gather(Buffer &src, Buffer &dst, GLsizeiptr elemSize, GLintptr srcOffset = 0); // dst[i] = src[value of i-th sorted pair], elemSize has to be a multiple of 4
+        std::vector<KeyValue> ReadBack();
+        bool Validate();
+        GLuint GetCapacity() const { return capacity; }
+    private:
+        static constexpr GLuint localSize = 256; // each local workgroup sorts 2 * localSize elements in shared memory
+        GLuint capacity, firstBinding;
+        FixedBuffer keyValueBuffer;
+        ComputeShader localShader, globalShader, gatherShader;
+    };
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <utility>
+namespace mGLu
+{
+    struct Handle // index into a HandleRegistry, generation 0 is the null handle
+    {
+        std::uint32_t index = 0, generation = 0;
+        explicit operator bool() const { return generation != 0; }
+        bool operator==(const Handle &other) const { return index == other.index && generation == other.generation; }
+    };
+    // Reference counts and per object state of GL resources in one dense table, so sharing an object costs an index
+    // instead of a heap allocation or a hash lookup. Freed slots are reused with a new generation, a stale Handle then
+    // simply stops resolving. GL objects only live on the context's thread, so neither is the registry thread safe.
+    template<typename Payload>
+    class HandleRegistry
+    {
+        struct __slot
+        {
+            Payload payload{};
+            unsigned int refCount = 0;
+            std::uint32_t generation = 1;
+        };
+        std::vector<__slot> slots;
+        std::vector<std::uint32_t> freeSlots;
+    public:
+        Handle Create(Payload payload) // with one reference
+        {
+            std::uint32_t index;
+            if(freeSlots.empty())
+            {
+                index = slots.size();
+                slots.emplace_back();
+            }
+            else
+            {
+                index = freeSlots.back();
+                freeSlots.pop_back();
+            }
+            slots[index].payload = std::move(payload);
+            slots[index].refCount = 1;
+            return {index, slots[index].generation};
+        }
+        void Retain(Handle handle)
+        {
+            if(IsAlive(handle))
+                ++slots[handle.index].refCount;
+        }
+        bool Release(Handle handle, Payload &released) // true if that was the last reference, released then holds the state to delete
+        {
+            if(!IsAlive(handle) || --slots[handle.index].refCount != 0)
+                return false;
+            __slot &slot = slots[handle.index];
+            released = std::move(slot.payload);
+            slot.payload = Payload{};
+            if(++slot.generation == 0) // never hand out the null generation
+                slot.generation = 1;
+            freeSlots.push_back(handle.index);
+            return true;
+        }
+        bool IsAlive(Handle handle) const
+        {
+            return handle.generation != 0 && handle.index < slots.size() && slots[handle.index].generation == handle.generation && slots[handle.index].refCount;
+        }
+        Payload* Get(Handle handle) // nullptr if the object is gone
+        {
+            return IsAlive(handle) ? &slots[handle.index].payload : nullptr;
+        }
+        const Payload* Get(Handle handle) const
+        {
+            return IsAlive(handle) ? &slots[handle.index].payload : nullptr;
+        }
+        std::size_t GetLiveCount() const
+        {
+            return slots.size() - freeSlots.size();
+        }
+    };
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+namespace mGLu
+{
+    // Work stealing thread pool. Every worker (and the thread that created the pool) owns a deque, it pushes and pops
+    // its own jobs at the back while idle workers steal from the front of the others.
+    // Jobs must not make GL calls, the context only exists on the thread running the Window.
+    class JobSystem
+    {
+        struct Job
+        {
+            std::function<void()> func;
+            std::atomic<int> pendingDependencies{1}; // +1 held by Submit() until every dependency is registered
+            std::mutex mutex;
+            bool done = false;
+            std::vector<std::shared_ptr<Job>> dependents; // enqueued once their last dependency finishes
+        };
+        struct WorkerQueue
+        {
+            std::mutex mutex;
+            std::deque<std::shared_ptr<Job>> jobs;
+        };
+    public:
+        using JobHandle = std::shared_ptr<Job>;
+
+        JobSystem(int workerCount = -1); // -1 starts one worker per remaining core, 0 runs everything on the waiting thread
+        JobSystem(const JobSystem&) = delete;
+        ~JobSystem();
+
+        JobHandle Submit(std::function<void()> func, std::initializer_list<JobHandle> dependencies = {}); // runs func once all dependencies are done
+        JobHandle Submit(std::function<void()> func, const std::vector<JobHandle> &dependencies);
+        void Wait(const JobHandle &job); // runs other jobs until job is done
+        static bool IsDone(const JobHandle &job);
+
+        // Calls func(chunkBegin, chunkEnd) for consecutive chunks of [begin, end) of at most grainSize elements
+        // across the pool and returns once all of them are done. The calling thread works on chunks too.
+        template<typename Func>
+        void ParallelFor(std::size_t begin, std::size_t end, std::size_t grainSize, Func &&func)
+        {
+            if(end <= begin)
+                return;
+            if(grainSize == 0)
+                grainSize = 1;
+            const std::size_t chunkCount = (end - begin + grainSize - 1) / grainSize;
+            if(chunkCount == 1)
+            {
+                func(begin, end);
+                return;
+            }
+            if(workers.empty()) // still chunked, func may index per chunk state by chunkBegin / grainSize
+            {
+                for(std::size_t chunkBegin = begin; chunkBegin < end; chunkBegin += grainSize)
+                    func(chunkBegin, std::min(chunkBegin + grainSize, end));
+                return;
+            }
+            std::vector<JobHandle> chunks;
+            chunks.reserve(chunkCount - 1);
+            for(std::size_t chunkBegin = begin + grainSize; chunkBegin < end; chunkBegin += grainSize)
+            {
+                const std::size_t chunkEnd = std::min(chunkBegin + grainSize, end);
+                chunks.push_back(Submit([&func, chunkBegin, chunkEnd]{ func(chunkBegin, chunkEnd); }));
+            }
+            func(begin, begin + grainSize);
+            for(const JobHandle &chunk : chunks)
+                Wait(chunk);
+        }
+        unsigned int GetWorkerCount() const { return workers.size(); }
+    private:
+        std::vector<std::thread> workers;
+        std::vector<std::unique_ptr<WorkerQueue>> queues; // queues[0] belongs to every thread that is not a worker
+        std::atomic<std::size_t> queuedCount{0};
+        std::mutex sleepMutex;
+        std::condition_variable wakeUp;
+        bool stop = false;
+
+        void Enqueue(JobHandle job);
+        JobHandle Pop(unsigned int queueIndex);
+        JobHandle Steal(unsigned int thiefIndex);
+        bool RunOne(); // runs one job if any is queued
+        void Run(const JobHandle &job);
+        void WorkerLoop(unsigned int queueIndex);
+        unsigned int CurrentQueue() const;
+    };
+}
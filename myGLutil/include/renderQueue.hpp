@@ -0,0 +1,164 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <vector>
+#include "drawable.hpp"
+#include "buffer.hpp"
+namespace mGLu
+{
+    enum class RenderPass : unsigned int
+    {
+        Background = 0,  // drawn first, everything else blends over it
+        Opaque = 1,      // grouped by state, front to back within equal state
+        Transparent = 2  // back to front, state only breaks ties
+    };
+    struct RenderPacket
+    {
+        ull key = 0; // RenderQueue::MakeKey()
+        Drawable *drawable = nullptr;
+        GLenum drawMode = GL_TRIANGLES;
+        unsigned int material = 0; // packets of one material on drawables that share state are merged, so their setups have to set the same state
+        DrawElementsIndirectCommand command = {}; // GL_UNSIGNED_INT indices, firstIndex includes the drawable's indexOffset
+        Buffer *indirectBuffer = nullptr; // if set, indirectCount commands already in it are drawn instead of command, never merged
+        GLintptr indirectOffset = 0;
+        GLsizei indirectCount = 1;
+        const void *drawData = nullptr; // drawDataSize bytes of per object data, read when Execute() runs, what differs between merged packets goes here
+        GLsizeiptr drawDataSize = 0;    // packets only merge with packets of the same size, their data is element gl_DrawIDARB at RenderQueue::drawDataBinding
+        std::function<void()> setup, finish; // run around every batch, after the drawable's shader is in use
+    };
+    struct RenderQueueStats
+    {
+        unsigned int packets = 0; // submitted for the last Execute()
+        unsigned int draws = 0;   // draw calls they were merged into
+    };
+    // Collects the frame's draws, sorts them by a 64 bit key and merges runs of direct indexed draws with the same material
+    // on drawables that share shader, VAO, index and vertex buffers into a single glMultiDrawElementsIndirect. The per object
+    // data of a run is packed into an SSBO the shader indexes with gl_DrawIDARB, so objects sharing a mesh cost one draw call.
+    // Key bits, most significant first: pass 2, then opaque: shader 12, VAO 12, material 14, depth 24,
+    // transparent: inverted depth 24, shader 12, VAO 12, material 14.
+    class RenderQueue
+    {
+        struct __sortEntry
+        {
+            ull key;
+            unsigned int index; // submission order, keeps equal keys stable
+            bool operator<(const __sortEntry &other) const
+            {
+                return key != other.key ? key < other.key : index < other.index;
+            }
+        };
+        std::vector<RenderPacket> packets;
+        std::vector<__sortEntry> order;
+        StreamBuffer commandStream, drawDataStream;
+        const GLsizei commandCapacity;
+        GLsizeiptr drawDataAlignment = 1;
+        bool drawIDs; // without gl_DrawIDARB only packets of one drawable and no per object data can merge
+        RenderQueueStats stats;
+
+        static ull DepthBits(float depth) // the bits of a non-negative float sort like its value
+        {
+            return std::bit_cast<std::uint32_t>(std::max(depth, 0.f)) >> 7;
+        }
+        bool Mergeable(const RenderPacket &a, const RenderPacket &b) const
+        {
+            if(a.indirectBuffer || b.indirectBuffer || a.material != b.material || a.drawMode != b.drawMode || a.drawDataSize != b.drawDataSize
+                || (a.key >> 62) != (b.key >> 62))
+                return false;
+            if(a.drawable == b.drawable && !a.drawDataSize)
+                return true;
+            return drawIDs && a.drawable->SharesStateWith(*b.drawable);
+        }
+        bool StageDrawData(std::size_t begin, std::size_t end, char *drawData, GLsizeiptr &drawDataUsed) // binds the run's per object data, false if it does not fit
+        {
+            const RenderPacket &first = packets[order[begin].index];
+            if(!first.drawDataSize)
+                return true;
+            const GLsizeiptr offset = (drawDataUsed + drawDataAlignment - 1) / drawDataAlignment * drawDataAlignment;
+            const GLsizeiptr size = first.drawDataSize * GLsizeiptr(end - begin);
+            if(!drawData || offset + size > drawDataStream.GetRegionSize())
+                return false;
+            for(std::size_t i = begin; i < end; i++)
+                std::memcpy(drawData + offset + first.drawDataSize * GLsizeiptr(i - begin), packets[order[i].index].drawData, first.drawDataSize);
+            drawDataUsed = offset + size;
+            GLState::BindShaderStorageBuffer(drawDataBinding, drawDataStream.GetName(), drawDataStream.GetOffset() + offset, size);
+            return true;
+        }
+    public:
+        static constexpr GLuint drawDataBinding = 0; // SSBO binding of the per object data of the batch being drawn
+        RenderQueue(GLsizei _commandCapacity = 256, GLsizeiptr drawDataCapacity = 64 * 1024): // direct draws and bytes of per object data per Execute()
+            commandStream(_commandCapacity * sizeof(DrawElementsIndirectCommand), 3, sizeof(DrawElementsIndirectCommand)),
+            drawDataStream(drawDataCapacity, 3),
+            commandCapacity(_commandCapacity),
+            drawIDs(GLEW_ARB_shader_draw_parameters)
+        {
+            GLint ssboAlignment = 1;
+            glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &ssboAlignment);
+            drawDataAlignment = std::max<GLsizeiptr>(ssboAlignment, 1);
+        }
+        static ull MakeKey(RenderPass pass, const Drawable &drawable, unsigned int material = 0, float depth = 0.f) // depth is the distance to the camera
+        {
+            const ull passBits = (ull)pass << 62;
+            const ull stateBits = ((ull)(drawable.shader.GetID() & 0xFFF) << 26) | ((ull)(drawable.vao.GetName() & 0xFFF) << 14) | (material & 0x3FFF);
+            if(pass == RenderPass::Transparent)
+                return passBits | ((0xFFFFFF - DepthBits(depth)) << 38) | stateBits;
+            return passBits | (stateBits << 24) | DepthBits(depth);
+        }
+        static DrawElementsIndirectCommand IndexedCommand(const Drawable &drawable, GLuint indexCount, GLuint instanceCount = 1, GLuint firstIndex = 0, GLuint baseInstance = 0) // firstIndex relative to the drawable's index range
+        {
+            return {indexCount, instanceCount, GLuint(drawable.indexOffset / sizeof(GLuint)) + firstIndex, 0, baseInstance};
+        }
+        void Submit(RenderPacket packet)
+        {
+            order.push_back({packet.key, (unsigned int)packets.size()});
+            packets.push_back(std::move(packet));
+        }
+        void Execute() // draws and clears everything submitted since the last Execute()
+        {
+            std::sort(order.begin(), order.end());
+            stats = {(unsigned int)packets.size(), 0};
+
+            DrawElementsIndirectCommand *commands = packets.empty() ? nullptr : commandStream.BeginWrite<DrawElementsIndirectCommand>();
+            char *drawData = packets.empty() ? nullptr : drawDataStream.BeginWrite<char>();
+            GLsizei commandCount = 0;
+            GLsizeiptr drawDataUsed = 0;
+            for(std::size_t begin = 0, end; begin < order.size(); begin = end)
+            {
+                RenderPacket &first = packets[order[begin].index];
+                end = begin + 1;
+                while(end < order.size() && Mergeable(first, packets[order[end].index]))
+                    ++end;
+
+                first.drawable->shader.Use();
+                if(first.setup)
+                    first.setup();
+                if(!StageDrawData(begin, end, drawData, drawDataUsed))
+                    std::fputs("RenderQueue: Error: more per object data than drawDataCapacity, the rest is dropped\n", stderr);
+                else if(first.indirectBuffer)
+                    first.drawable->MultiDrawIndexedIndirect(*first.indirectBuffer, first.indirectCount, first.indirectOffset, 0, first.drawMode);
+                else if(commands && commandCount + GLsizei(end - begin) <= commandCapacity)
+                {
+                    const GLintptr offset = commandStream.GetOffset() + commandCount * sizeof(DrawElementsIndirectCommand);
+                    for(std::size_t i = begin; i < end; i++)
+                        commands[commandCount++] = packets[order[i].index].command;
+                    first.drawable->MultiDrawIndexedIndirect(commandStream, end - begin, offset, 0, first.drawMode);
+                }
+                else
+                    std::fputs("RenderQueue: Error: more direct draws than commandCapacity, the rest is dropped\n", stderr);
+                if(first.finish)
+                    first.finish();
+                ++stats.draws;
+            }
+            packets.clear();
+            order.clear();
+        }
+        const RenderQueueStats& GetStats() const
+        {
+            return stats;
+        }
+    };
+}
@@ -1,6 +1,6 @@
 #pragma once
 #include <cstdio>
-#include <unordered_map>
+#include "handles.hpp"
 namespace mGLu
 {
 	class Window;
@@ -8,9 +8,14 @@ namespace mGLu
 	{
 		friend class Window;
 	private:
-		static std::unordered_map<GLuint, unsigned int> instanceCount;
+		static HandleRegistry<GLuint>& Registry(); // program names, one slot per program however many Shaders share it
+		Handle handle;
 		GLuint ID = 0;
+		void Release();
 		Shader(const char* const vsCode, const char* const fsCode, const char* const gsCode = nullptr);
+	protected:
+		explicit Shader(GLuint programID);
+	private:
 		
 		static const char *globalVarsShaderPrefix;
 		static const std::size_t globalVarsShaderPrefixLength;
@@ -27,9 +32,30 @@ namespace mGLu
 		Shader(const Shader& other);
 		Shader& operator=(const Shader& other);
 		Shader(Shader&& other) noexcept;
+		Shader& operator=(Shader&& other) noexcept;
 		~Shader();
 
 		GLuint GetID() const;
+		Handle GetHandle() const;
 		void Use() const;
+
+		// Linked programs are stored there keyed by a hash of their final source and the GL driver, and loaded
+		// instead of compiled while both are unchanged. nullptr or "" turns the cache off, which is the default.
+		// Beyond maxPrograms files the least recently used ones are deleted, once per call.
+		static void SetBinaryCacheDirectory(const char *directory, std::size_t maxPrograms = 512);
+	};
+	class TessellationShader : public Shader // draws have to use GL_PATCHES
+	{
+	public:
+		TessellationShader();
+		TessellationShader(const Window &window, const char* const vsCode, const char* const tcsCode, const char* const tesCode,
+				const char* const fsCode, const char* const gsCode = nullptr);
+	};
+	class ComputeShader : public Shader
+	{
+	public:
+		ComputeShader();
+		ComputeShader(const Window &window, const char* const csCode);
+		void Dispatch(GLuint groupsX, GLuint groupsY = 1, GLuint groupsZ = 1) const; // Use()s the program and dispatches, memory barriers are left to the caller
 	};
 }
\ No newline at end of file
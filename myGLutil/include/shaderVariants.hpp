@@ -0,0 +1,52 @@
+#pragma once
+#include <GL/glew.h>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "shader.hpp"
+namespace mGLu
+{
+    struct ShaderOption
+    {
+        const char *name;             // #defined to its value in every variant
+        unsigned int valueCount = 2;  // values 0 to valueCount - 1, 2 for an on/off switch
+        unsigned int defaultValue = 0;
+    };
+    // One shader source compiled once per combination of option values, every option a #define, so branches on them
+    // are folded and loops over them unrolled by the compiler instead of tested per fragment on a uniform.
+    // Get() compiles a variant the first time it is asked for, Precompile() does so ahead of the draw that needs it.
+    class ShaderVariants
+    {
+    public:
+        using Key = std::uint32_t; // the option values in mixed radix, the first option least significant
+        using Builder = std::function<Shader(Key key, const std::string &defines)>; // creates one variant, defines have to follow #version
+        using Initializer = std::function<void(Shader &shader)>; // runs on every new variant while it is in use, for uniforms not set per draw, the program in use before is restored after
+    private:
+        std::vector<ShaderOption> options;
+        std::vector<Key> placeValues;
+        Builder builder;
+        Initializer initializer;
+        std::unordered_map<Key, Shader> variants;
+    public:
+        ShaderVariants();
+        ShaderVariants(std::initializer_list<ShaderOption> _options, Builder _builder, Initializer _initializer = nullptr);
+
+        Key GetDefaultKey() const;
+        Key With(Key key, unsigned int option, unsigned int value) const; // key with one option changed, value is clamped to its range
+        unsigned int GetValue(Key key, unsigned int option) const;
+        std::string GetDefines(Key key) const;
+
+        const Shader& Get(Key key);
+        void Precompile(Key key);
+        std::size_t GetCompiledCount() const;
+        template<typename Func>
+        void ForEachCompiled(Func func) // for uniforms all variants share, Initializer covers the ones compiled later
+        {
+            for(auto &[key, shader] : variants)
+                func(shader);
+        }
+    };
+}
@@ -4,139 +4,341 @@
 #include <cstdio>
 #include <array>
 #include <string>
+#include <initializer_list>
+#include <unordered_map>
 #include "common.hpp"
+#include "handles.hpp"
+#include "glState.hpp"
 
 namespace mGLu
 {
     class VAOview
     {
-        unsigned int *const refCount = nullptr;
+        struct __VAOstate
+        {
+            GLuint name = 0;
+            GLuint bindingCount = 0;
+            bool pulling = false;
+        };
+        static HandleRegistry<__VAOstate>& Registry()
+        {
+            static HandleRegistry<__VAOstate> registry;
+            return registry;
+        }
+        Handle handle;
         GLuint name = 0;
+        void Release()
+        {
+            __VAOstate released;
+            if(Registry().Release(handle, released))
+            {
+                GLState::ForgetVertexArray(released.name);
+                glDeleteVertexArrays(1, &released.name);
+            }
+            handle = {};
+            name = 0;
+        }
     protected:
-        GLuint *const bindingCount = nullptr;
-        VAOview(int):
-            refCount(new unsigned int(1)),
-            bindingCount(new GLuint(0))
+        VAOview(int, bool pulling = false)
         {
             glCreateVertexArrays(1, &name);
+            handle = Registry().Create({name, 0, pulling});
+        }
+        explicit VAOview(Handle existing) // shares a VAO that is still alive, stays empty otherwise
+        {
+            if(const __VAOstate *state = Registry().Get(existing))
+            {
+                Registry().Retain(existing);
+                handle = existing;
+                name = state->name;
+            }
+        }
+        GLuint& BindingCount() // only called on VAOs that were created, so the handle is alive
+        {
+            return Registry().Get(handle)->bindingCount;
         }
     public:
+        static constexpr GLuint pullLayoutBinding = 11; // SSBO binding of the pulled layout, binding point i is pulled from SSBO binding pullLayoutBinding + 1 + i
         VAOview()
         {
 
         }
         VAOview(const VAOview& other):
-            name(other.name),
-            refCount(other.refCount),
-            bindingCount(other.bindingCount)
+            handle(other.handle),
+            name(other.name)
         {
-
+            Registry().Retain(handle);
+        }
+        VAOview(VAOview&& other) noexcept:
+            handle(other.handle),
+            name(other.name)
+        {
+            other.handle = {};
+            other.name = 0;
         }
         VAOview& operator=(const VAOview& other)
         {
-            if(name && --*refCount == 0)
-            {
-                glDeleteVertexArrays(1, &name);
-                delete refCount;
-                delete bindingCount;
-            }
+            Registry().Retain(other.handle);
+            Release();
+            handle = other.handle;
             name = other.name;
-            const_cast<unsigned int*&>(refCount) = other.refCount;
-            const_cast<GLuint*&>(bindingCount) = other.bindingCount;
-            ++*refCount;
             return *this;
         }
-        virtual ~VAOview()
+        VAOview& operator=(VAOview&& other) noexcept
         {
-            if(name && --*refCount == 0)
+            if(this != &other)
             {
-                glDeleteVertexArrays(1, &name);
-                delete refCount;
-                delete bindingCount;
+                Release();
+                handle = other.handle;
+                name = other.name;
+                other.handle = {};
+                other.name = 0;
             }
+            return *this;
+        }
+        virtual ~VAOview()
+        {
+            Release();
         }
         void BindBufferToAttrib(GLuint bindingPoint, GLuint vbo, GLintptr offset, GLsizei stride)
         {
-            glVertexArrayVertexBuffer(name, bindingPoint, vbo, offset, stride);
+            GLState::VertexArrayVertexBuffer(name, bindingPoint, vbo, offset, stride);
         }
         void BindElementBuffer(unsigned int ebo)
         {
-            glVertexArrayElementBuffer(name, ebo);
+            GLState::VertexArrayElementBuffer(name, ebo);
         }
-        GLuint GetName()
+        GLuint GetName() const
         {
             return name;
         }
-        GLuint GetBindingCount()
+        GLuint GetBindingCount() const
+        {
+            const __VAOstate *state = Registry().Get(handle);
+            return state ? state->bindingCount : 0;
+        }
+        Handle GetHandle() const
         {
-            if(!name) return 0;
-            return *bindingCount;
+            return handle;
+        }
+        static bool IsAlive(Handle vaoHandle)
+        {
+            return Registry().IsAlive(vaoHandle);
+        }
+        bool IsPulling() const // attributes are fetched from SSBOs in the vertex shader, the GL object has none enabled
+        {
+            const __VAOstate *state = Registry().Get(handle);
+            return state && state->pulling;
         }
     };
+    struct VertexAttrib // one AddAttrib() call
+    {
+        GLenum type;
+        unsigned int size;
+        const char *name;
+        unsigned int divisor = 0;
+        bool normalized = false;
+    };
     class VAO : public VAOview
     {
+        struct __sharedEntry
+        {
+            Handle handle;
+            std::string shaderPrefix;
+            GLuint nextIndex;
+        };
+        static std::unordered_map<std::string, __sharedEntry>& SharedCache() // weak, a format whose VAOs all died is recreated
+        {
+            static std::unordered_map<std::string, __sharedEntry> cache;
+            return cache;
+        }
         std::string shaderPrefix;
         GLuint nextIndex= 0;
-    public:
-        VAO():
-            VAOview(0)
+        bool pulling = false;
+
+        VAO(Handle existing, const __sharedEntry &entry):
+            VAOview(existing),
+            shaderPrefix(entry.shaderPrefix),
+            nextIndex(entry.nextIndex),
+            pulling(IsPulling())
         {
 
         }
-        GLuint AddAttrib(GLenum type, unsigned int size, std::string shaderVarName, unsigned int divisor = 0)
+        static bool PullingSupported(GLuint attribCount)
+        {
+            GLint vertexBlocks = 0, bindings = 0;
+            glGetIntegerv(GL_MAX_VERTEX_SHADER_STORAGE_BLOCKS, &vertexBlocks);
+            glGetIntegerv(GL_MAX_SHADER_STORAGE_BUFFER_BINDINGS, &bindings);
+            return (GLuint)vertexBlocks > attribCount && (GLuint)bindings > pullLayoutBinding + attribCount;
+        }
+        static const char* PulledComponent(GLenum type, bool normalized) // GLSL turning the raw bits r of one component into its value
+        {
+            switch(type)
+            {
+            case GL_FLOAT:
+                return "uintBitsToFloat(r)";
+            case GL_HALF_FLOAT:
+                return "unpackHalf2x16(r).x";
+            case GL_INT:
+                return "int(r)";
+            case GL_UNSIGNED_SHORT:
+                return normalized ? "float(r) / 65535.0" : "r";
+            case GL_UNSIGNED_BYTE:
+                return normalized ? "float(r) / 255.0" : "r";
+            case GL_SHORT:
+                return normalized ? "max(float(bitfieldExtract(int(r), 0, 16)) / 32767.0, -1.0)" : "bitfieldExtract(int(r), 0, 16)";
+            case GL_BYTE:
+                return normalized ? "max(float(bitfieldExtract(int(r), 0, 8)) / 127.0, -1.0)" : "bitfieldExtract(int(r), 0, 8)";
+            default: // GL_UNSIGNED_INT
+                return "r";
+            }
+        }
+        // Declares shaderVarName as a macro calling a fetch from the SSBO of binding point binding, addressed by the
+        // byte offset and stride the Drawable uploads to pullLayoutBinding
+        void AddPulledAttrib(GLuint binding, GLenum type, unsigned int size, const std::string &shaderVarName, unsigned int divisor, bool normalized)
+        {
+            const unsigned int componentBytes = type == GL_FLOAT || type == GL_INT || type == GL_UNSIGNED_INT ? 4 :
+                                                type == GL_HALF_FLOAT || type == GL_SHORT || type == GL_UNSIGNED_SHORT ? 2 : 1;
+            if(shaderPrefix.empty())
+                shaderPrefix +=
+                    "#ifdef GL_ARB_shader_draw_parameters\n"
+                    "#define _mGLuBaseInstance uint(gl_BaseInstanceARB)\n"
+                    "#else\n"
+                    "#define _mGLuBaseInstance 0u\n"
+                    "#endif\n"
+                    "layout(std430, binding = " + std::to_string(pullLayoutBinding) + ") readonly buffer _MGLU_PULL_LAYOUT { uvec2 _mGLuPullLayout[]; };\n";
+            const std::string b = std::to_string(binding);
+            const std::string index = divisor ? "uint(gl_InstanceID) / " + std::to_string(divisor) + "u + _mGLuBaseInstance" : "uint(gl_VertexID)";
+            shaderPrefix +=
+                "layout(std430, binding = " + std::to_string(pullLayoutBinding + 1 + binding) + ") readonly buffer _MGLU_PULL_" + b + " { uint _mGLuPull" + b + "[]; };\n"
+                "uint _mGLuPullBits" + b + "(uint component)\n"
+                "{\n"
+                "    uint addr = _mGLuPullLayout[" + b + "].x + (" + index + ") * _mGLuPullLayout[" + b + "].y + component * " + std::to_string(componentBytes) + "u;\n"
+                "    uint word = addr >> 2, shift = (addr & 3u) * 8u;\n"
+                "    uint r = _mGLuPull" + b + "[word] >> shift;\n"
+                "    if(shift + " + std::to_string(componentBytes * 8) + "u > 32u)\n"
+                "        r |= _mGLuPull" + b + "[word + 1u] << (32u - shift);\n"
+                "    return " + (componentBytes == 4 ? std::string("r") : "r & " + std::to_string((1u << componentBytes * 8) - 1) + "u") + ";\n"
+                "}\n";
+            const std::string glslType = GetGLSLtype(size, type, normalized), componentType = GetGLSLtype(1, type, normalized);
+            shaderPrefix += glslType + " _mGLuPull_" + shaderVarName + "()\n{\n    uint r;\n";
+            std::string components;
+            for(unsigned int c = 0; c < size; c++)
+            {
+                shaderPrefix += "    r = _mGLuPullBits" + b + "(" + std::to_string(c) + "u);\n";
+                shaderPrefix += "    " + componentType + " v" + std::to_string(c) + " = " + PulledComponent(type, normalized) + ";\n";
+                components += (c ? ", v" : "v") + std::to_string(c);
+            }
+            shaderPrefix += "    return " + glslType + "(" + components + ");\n}\n";
+            shaderPrefix += "#define " + shaderVarName + " _mGLuPull_" + shaderVarName + "()\n";
+        }
+        GLuint SetupAttrib(GLenum type, unsigned int size, unsigned int divisor, bool normalized) // the GL side of AddAttrib(), at location nextIndex
         {
             glEnableVertexArrayAttrib(GetName(), nextIndex); 
-            glVertexArrayAttribFormat(GetName(), nextIndex, size, type, GL_FALSE, 0);
-            glVertexArrayAttribBinding(GetName(), nextIndex, *bindingCount);
-            glVertexArrayBindingDivisor(GetName(), *bindingCount, divisor);
-            
-            static constexpr unsigned int shaderCodeSize = 255;
-            char shaderCode[shaderCodeSize];
-            int parseLen = std::snprintf( shaderCode, shaderCodeSize, "layout(location = %u) in %s %s;\n", nextIndex, GetGLSLtype(size, type), shaderVarName.data());
-            if(parseLen >= shaderCodeSize)
-                fputs("VAO error: parsed shaderCode is to big!\n", stderr);
-            shaderPrefix += shaderCode;
+            if(type == GL_DOUBLE)
+                glVertexArrayAttribLFormat(GetName(), nextIndex, size, type, 0);
+            else if(normalized || type == GL_FLOAT || type == GL_HALF_FLOAT || type == GL_FIXED)
+                glVertexArrayAttribFormat(GetName(), nextIndex, size, type, normalized, 0);
+            else
+                glVertexArrayAttribIFormat(GetName(), nextIndex, size, type, 0);
+            glVertexArrayAttribBinding(GetName(), nextIndex, BindingCount());
+            glVertexArrayBindingDivisor(GetName(), BindingCount(), divisor);
             ++nextIndex;
-            return (*bindingCount)++;
+            return BindingCount()++;
+        }
+    public:
+        VAO(bool pullVertices = false): // pulled VAOs read every attribute from SSBOs by gl_VertexID / gl_InstanceID, see AddPulledAttrib
+            VAOview(0, pullVertices),
+            pulling(pullVertices)
+        {
+
+        }
+        // VAOs of one format are shared, binding point i is attribs[i]. Pulling falls back to attributes where the vertex stage has too few SSBOs
+        static VAO Shared(std::initializer_list<VertexAttrib> attribs, bool pullVertices = false)
+        {
+            return Shared(attribs.begin(), attribs.size(), pullVertices);
+        }
+        // declaration, if given, is the GLSL of the attributes at locations 0 to attribCount - 1 and replaces the generated one
+        static VAO Shared(const VertexAttrib *attribs, std::size_t attribCount, bool pullVertices, const char *declaration = nullptr)
+        {
+            if(pullVertices && !PullingSupported(attribCount))
+            {
+                std::fputs("VAO: Warning: vertex shader storage blocks are not supported well enough for pulling, falling back to attributes\n", stderr);
+                pullVertices = false;
+            }
+            std::string key = pullVertices ? "pull" : "attrib";
+            for(std::size_t i = 0; i < attribCount; i++)
+                key += ";" + std::to_string(attribs[i].type) + "," + std::to_string(attribs[i].size) + "," + std::to_string(attribs[i].divisor) + "," + std::to_string(attribs[i].normalized) + "," + attribs[i].name;
+            auto cached = SharedCache().find(key);
+            if(cached != SharedCache().end() && IsAlive(cached->second.handle))
+                return VAO(cached->second.handle, cached->second);
+            VAO vao(pullVertices);
+            const bool declared = declaration && !pullVertices;
+            for(std::size_t i = 0; i < attribCount; i++)
+            {
+                if(declared)
+                    vao.SetupAttrib(attribs[i].type, attribs[i].size, attribs[i].divisor, attribs[i].normalized);
+                else
+                    vao.AddAttrib(attribs[i].type, attribs[i].size, attribs[i].name, attribs[i].divisor, attribs[i].normalized);
+            }
+            if(declared)
+                vao.shaderPrefix = declaration;
+            SharedCache()[key] = {vao.GetHandle(), vao.shaderPrefix, vao.nextIndex};
+            return vao;
+        }
+        template<typename Format>
+        static VAO FromFormat(bool pullVertices = false) // a VertexFormat, shared like Shared() but with its declaration computed at compile time
+        {
+            return Shared(Format::attribs.data(), Format::attribs.size(), pullVertices, Format::declaration.data());
+        }
+        // integer types are read as ints unless normalized, which maps them to [0, 1] ([-1, 1] if signed) floats
+        GLuint AddAttrib(GLenum type, unsigned int size, std::string shaderVarName, unsigned int divisor = 0, bool normalized = false)
+        {
+            if(pulling)
+            {
+                if(type == GL_DOUBLE || type == GL_FIXED)
+                    fputs("VAO error: double and fixed point attributes can not be pulled!\n", stderr);
+                else
+                    AddPulledAttrib(BindingCount(), type, size, shaderVarName, divisor, normalized);
+                return BindingCount()++;
+            }
+            const char *glslType = GetGLSLtype(size, type, normalized);
+            if(!glslType)
+                fputs("VAO error: attribute has no GLSL type!\n", stderr);
+            shaderPrefix += "layout(location = " + std::to_string(nextIndex) + ") in " + (glslType ? glslType : "float") + " " + shaderVarName + ";\n";
+            return SetupAttrib(type, size, divisor, normalized);
         }
         GLuint AddFloatMatAttrib(unsigned int cols, unsigned int rows, std::string shaderVarName, unsigned int divisor)
         {
+            if(pulling)
+                fputs("VAO error: matrix attributes can not be pulled!\n", stderr);
             for (int i = 0; i < cols; i++) {	   // MODEL TRANSFORM MATRIX
                 glEnableVertexArrayAttrib(GetName(), nextIndex + i);
                 glVertexArrayAttribFormat(GetName(), nextIndex + i, rows, GL_FLOAT, GL_FALSE, i*4*sizeof(float));
-                glVertexArrayAttribBinding(GetName(), nextIndex + i, *bindingCount);
+                glVertexArrayAttribBinding(GetName(), nextIndex + i, BindingCount());
             }
-            glVertexArrayBindingDivisor(GetName(), *bindingCount, divisor);
+            glVertexArrayBindingDivisor(GetName(), BindingCount(), divisor);
 
-            static constexpr unsigned int shaderCodeSize = 255;
-            char shaderCode[255] = "layout(location=LLLL) T N;";
-            int parseLen = std::snprintf( shaderCode, shaderCodeSize, "layout(location = %u) in mat%ux%u %s;\n", nextIndex, cols, rows, shaderVarName.data());
-            if(parseLen >= shaderCodeSize)
-                fputs("VAO error: parsed shaderCode is to big!\n", stderr);
-            shaderPrefix += shaderCode;
+            shaderPrefix += "layout(location = " + std::to_string(nextIndex) + ") in mat" + std::to_string(cols) + "x" + std::to_string(rows) + " " + shaderVarName + ";\n";
             nextIndex += rows;
             
-            return (*bindingCount)++;
+            return BindingCount()++;
         }
         GLuint AddDoubleMatAttrib(unsigned int cols, unsigned int rows, std::string shaderVarName, unsigned int divisor)
         {
+            if(pulling)
+                fputs("VAO error: matrix attributes can not be pulled!\n", stderr);
             for (int i = 0; i < rows; i++) {	   // MODEL TRANSFORM MATRIX
                 glEnableVertexArrayAttrib(GetName(), nextIndex + i);
                 glVertexArrayAttribFormat(GetName(), nextIndex + i, cols, GL_DOUBLE, GL_FALSE, i*4*sizeof(float));
-                glVertexArrayAttribBinding(GetName(), nextIndex + i, *bindingCount);
+                glVertexArrayAttribBinding(GetName(), nextIndex + i, BindingCount());
             }
-            glVertexArrayBindingDivisor(GetName(), *bindingCount, divisor);
+            glVertexArrayBindingDivisor(GetName(), BindingCount(), divisor);
 
-            static constexpr unsigned int shaderCodeSize = 255;
-            char shaderCode[255] = "layout(location=LLLL) T N;";
-            
-            int parseLen = std::snprintf( shaderCode, shaderCodeSize, "layout(location = %u) in dmat%ux%u %s;\n", nextIndex, cols, rows, shaderVarName.data());
-            if(parseLen >= shaderCodeSize)
-                fputs("VAO error: parsed shaderCode is to big!\n", stderr);
-            shaderPrefix += shaderCode;
+            shaderPrefix += "layout(location = " + std::to_string(nextIndex) + ") in dmat" + std::to_string(cols) + "x" + std::to_string(rows) + " " + shaderVarName + ";\n";
             nextIndex += rows;
             
-            return (*bindingCount)++;
+            return BindingCount()++;
         }
         const std::string& GetShaderPrefix()
         {
@@ -0,0 +1,169 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <type_traits>
+#include "common.hpp"
+#include "vao.hpp"
+namespace mGLu
+{
+    template<std::size_t N>
+    struct FixedString // string literal usable as a template argument
+    {
+        char data[N] = {};
+        constexpr FixedString(const char (&str)[N])
+        {
+            std::copy_n(str, N, data);
+        }
+    };
+    struct Half // component tag for 16 bit floats, GLhalf is just an unsigned short
+    {
+        GLushort bits;
+    };
+    template<typename T> struct GLComponent;
+    template<> struct GLComponent<GLfloat>  { static constexpr GLenum type = GL_FLOAT; };
+    template<> struct GLComponent<Half>     { static constexpr GLenum type = GL_HALF_FLOAT; };
+    template<> struct GLComponent<GLdouble> { static constexpr GLenum type = GL_DOUBLE; };
+    template<> struct GLComponent<GLint>    { static constexpr GLenum type = GL_INT; };
+    template<> struct GLComponent<GLuint>   { static constexpr GLenum type = GL_UNSIGNED_INT; };
+    template<> struct GLComponent<GLshort>  { static constexpr GLenum type = GL_SHORT; };
+    template<> struct GLComponent<GLushort> { static constexpr GLenum type = GL_UNSIGNED_SHORT; };
+    template<> struct GLComponent<GLbyte>   { static constexpr GLenum type = GL_BYTE; };
+    template<> struct GLComponent<GLubyte>  { static constexpr GLenum type = GL_UNSIGNED_BYTE; };
+
+    // Size components of type Component, read as the GLSL type GetGLSLtype() gives for them
+    template<FixedString Name, typename Component, unsigned int Size, unsigned int Divisor = 0, bool Normalized = false>
+    struct Attr
+    {
+        static constexpr GLenum type = GLComponent<Component>::type;
+        static_assert(!Normalized || std::is_integral_v<Component>, "only integer components can be normalized");
+        static_assert(GetGLSLtype(Size, type, Normalized) != nullptr, "attributes have 1 to 4 components");
+        static constexpr bool isAttrib = true;
+        static constexpr unsigned int bytes = sizeof(Component) * Size, alignment = sizeof(Component);
+        static constexpr VertexAttrib Attrib()
+        {
+            return {type, Size, Name.data, Divisor, Normalized};
+        }
+    };
+    template<unsigned int Bytes>
+    struct Pad // bytes in between that no attribute reads
+    {
+        static constexpr bool isAttrib = false;
+        static constexpr unsigned int bytes = Bytes, alignment = 1;
+        static constexpr VertexAttrib Attrib()
+        {
+            return {};
+        }
+    };
+
+    namespace __vertexLayout
+    {
+        constexpr bool Equal(const char *a, const char *b)
+        {
+            for(; *a && *a == *b; a++, b++);
+            return *a == *b;
+        }
+        template<std::size_t N>
+        constexpr std::size_t WriteDeclaration(const std::array<VertexAttrib, N> &attribs, char *out) // out may be nullptr to only count
+        {
+            std::size_t length = 0;
+            auto put = [&](const char *str){
+                for(; *str; str++, length++)
+                    if(out)
+                        out[length] = *str;
+            };
+            for(GLuint location = 0; location < N; location++)
+            {
+                char digits[11] = {};
+                int digitCount = 0;
+                for(GLuint rest = location; rest || !digitCount; rest /= 10)
+                    digits[digitCount++] = '0' + rest % 10;
+                std::reverse(digits, digits + digitCount);
+                put("layout(location = ");
+                put(digits);
+                put(") in ");
+                put(GetGLSLtype(attribs[location].size, attribs[location].type, attribs[location].normalized));
+                put(" ");
+                put(attribs[location].name);
+                put(";\n");
+            }
+            return length;
+        }
+        template<std::size_t Length, std::size_t N>
+        constexpr std::array<char, Length + 1> MakeDeclaration(const std::array<VertexAttrib, N> &attribs)
+        {
+            std::array<char, Length + 1> text = {};
+            WriteDeclaration(attribs, text.data());
+            return text;
+        }
+    }
+
+    // Attributes interleaved in one buffer. Every member starts at the next multiple of its component size,
+    // the stride is rounded up to the largest component size and at least 4 bytes.
+    // Compare stride and OffsetOf() against the struct that is uploaded with static_assert.
+    template<typename... Members>
+    class VertexLayout
+    {
+        static constexpr std::array<GLuint, sizeof...(Members)> memberOffsets = []{
+            std::array<GLuint, sizeof...(Members)> offsets = {};
+            GLuint end = 0;
+            std::size_t i = 0;
+            ((end = (end + Members::alignment - 1) / Members::alignment * Members::alignment, offsets[i++] = end, end += Members::bytes), ...);
+            return offsets;
+        }();
+        static constexpr GLuint endBytes = sizeof...(Members) ? memberOffsets.back() + (0, ..., Members::bytes) : 0;
+        static constexpr GLuint strideAlignment = std::max({4u, Members::alignment...});
+    public:
+        static constexpr GLuint attribCount = (0 + ... + Members::isAttrib);
+        static constexpr GLsizei stride = (endBytes + strideAlignment - 1) / strideAlignment * strideAlignment;
+        static constexpr std::array<VertexAttrib, attribCount> attribs = []{
+            std::array<VertexAttrib, attribCount> result = {};
+            std::size_t i = 0;
+            ((Members::isAttrib ? (void)(result[i++] = Members::Attrib()) : (void)0), ...);
+            return result;
+        }();
+        static constexpr std::array<GLuint, attribCount> attribOffsets = []{
+            std::array<GLuint, attribCount> result = {};
+            std::size_t attrib = 0, member = 0;
+            ((Members::isAttrib ? (void)(result[attrib++] = memberOffsets[member]) : (void)0, member++), ...);
+            return result;
+        }();
+        template<FixedString Name>
+        static constexpr GLuint OffsetOf() // ~0u if there is no such attribute
+        {
+            for(GLuint i = 0; i < attribCount; i++)
+                if(__vertexLayout::Equal(attribs[i].name, Name.data))
+                    return attribOffsets[i];
+            return ~0u;
+        }
+    };
+    // Everything a VAO reads: the attributes of all Layouts in order, attribute i at location and binding point i
+    template<typename... Layouts>
+    class VertexFormat
+    {
+    public:
+        static constexpr GLuint attribCount = (0 + ... + Layouts::attribCount);
+        static constexpr std::array<VertexAttrib, attribCount> attribs = []{
+            std::array<VertexAttrib, attribCount> result = {};
+            std::size_t i = 0;
+            ([&]{
+                for(const VertexAttrib &attrib : Layouts::attribs)
+                    result[i++] = attrib;
+            }(), ...);
+            return result;
+        }();
+        static constexpr auto declaration = __vertexLayout::MakeDeclaration<__vertexLayout::WriteDeclaration(attribs, nullptr)>(attribs); // the GLSL inputs, '\0' terminated
+        template<typename Layout>
+        static constexpr GLuint FirstBinding()
+        {
+            static_assert((std::is_same_v<Layout, Layouts> || ...), "Layout is not part of this format");
+            GLuint binding = 0;
+            bool found = false;
+            ((found = found || std::is_same_v<Layout, Layouts>, binding += found ? 0 : Layouts::attribCount), ...);
+            return binding;
+        }
+    };
+    using PositionLayout = VertexLayout<Attr<"inPos", float, 3>>; // just positions, the most common format
+    using PositionFormat = VertexFormat<PositionLayout>;
+}
@@ -17,7 +17,11 @@ namespace mGLu
 		glm::vec2 mousePos = {0.f,0.f}, prevMousePos = {0.f, 0.f};
 		glm::vec2 mouseScroll;
 		std::chrono::time_point<std::chrono::high_resolution_clock> lastFrameTime, currFrameTime, startTime;
-		float deltaTime, mainLoopTime;
+		float deltaTime = 0.f, mainLoopTime = 0.f;
+		float fixedTimeStep = 0.f; // 0 disables FixedUpdate
+		float fixedAccumulator = 0.f, fixedTimeOffset = 0.f;
+		unsigned long long fixedTickCount = 0;
+		void RunFixedSteps();
 		bool m_shouldClose = false;
 		GLFWwindow* window = nullptr;
 		static std::unordered_map<GLFWwindow*, glm::vec2> _mouseScroll;
@@ -56,8 +60,13 @@ namespace mGLu
 
 		virtual const char* GetShaderPrefix(std::size_t *outPrefixLength) const;
 		GLFWwindow* GetWindow() const { return window; }
-		inline float DeltaTime() const { return deltaTime; }
-		inline float GetTime() const { return mainLoopTime; }
+		inline float DeltaTime() const { return deltaTime; } // the fixed time step while inside FixedUpdate
+		inline float GetTime() const { return mainLoopTime; } // simulation time (start + ticks * step) while inside FixedUpdate
+		void SetFixedTimeStep(float step); // calls FixedUpdate every step seconds of simulation time before each Update, 0 turns it off
+		float FixedTimeStep() const { return fixedTimeStep; }
+		float FixedAlpha() const { return fixedTimeStep > 0.f ? fixedAccumulator / fixedTimeStep : 1.f; } // how far Update is between the last two ticks
+		unsigned long long FixedTickCount() const { return fixedTickCount; } // ticks since the last SetFixedTimeStep
+		unsigned int maxFixedStepsPerFrame = 8; // simulation time beyond this is dropped so slow frames can not snowball
 		float GetAspectRatio() const { return ratio; }
 		glm::vec2 GetSize() const { return size; }
 		glm::vec2 GetMousePos() const { return mousePos; }
@@ -69,5 +78,6 @@ namespace mGLu
 		void Close() { m_shouldClose = true; }
 		virtual void Start(){};
 		virtual void Update(){};
+		virtual void FixedUpdate(){};
 	};
 }
@@ -4,8 +4,16 @@
 #include "include/common.hpp"
 #include "include/drawable.hpp"
 #include "include/shader.hpp"
+#include "include/shaderVariants.hpp"
 #include "include/window.hpp"
 #include "include/camera.hpp"
 #include "include/mesh.hpp"
 #include "include/vao.hpp"
-#include "include/buffer.hpp"
\ No newline at end of file
+#include "include/vertexLayout.hpp"
+#include "include/handles.hpp"
+#include "include/glState.hpp"
+#include "include/buffer.hpp"
+#include "include/bufferArena.hpp"
+#include "include/renderQueue.hpp"
+#include "include/gpusort.hpp"
+#include "include/jobs.hpp"
\ No newline at end of file
@@ -0,0 +1,108 @@
+#include <GL/glew.h>
+
+#include <cstdio>
+
+#include "bufferArena.hpp"
+
+static GLsizeiptr __RoundUpToPowerOfTwo(GLsizeiptr size)
+{
+    GLsizeiptr power = 1;
+    while(power < size)
+        power <<= 1;
+    return power;
+}
+
+mGLu::BufferArena::BufferArena(GLsizeiptr _blockSize, GLsizeiptr _minBlockSize):
+    blockSize(std::max(__RoundUpToPowerOfTwo(_blockSize), __RoundUpToPowerOfTwo(std::max<GLsizeiptr>(_minBlockSize, 1)))),
+    minBlockSize(__RoundUpToPowerOfTwo(std::max<GLsizeiptr>(_minBlockSize, 1)))
+{
+
+}
+unsigned int mGLu::BufferArena::OrderOf(GLsizeiptr size) const
+{
+    unsigned int order = 0;
+    while(BlockBytes(order) < size)
+        ++order;
+    return order;
+}
+void mGLu::BufferArena::AddBlock(unsigned int maxOrder)
+{
+    __block block;
+    block.buffer = FixedBuffer(BlockBytes(maxOrder), nullptr, GL_DYNAMIC_STORAGE_BIT);
+    block.maxOrder = maxOrder;
+    block.freeBlocks.resize(maxOrder + 1);
+    block.freeBlocks[maxOrder].insert(0);
+    blocks.push_back(std::move(block));
+}
+bool mGLu::BufferArena::AllocateFrom(__block &block, unsigned int order, GLintptr &offset)
+{
+    unsigned int splitOrder = order;
+    while(splitOrder <= block.maxOrder && block.freeBlocks[splitOrder].empty())
+        ++splitOrder;
+    if(splitOrder > block.maxOrder)
+        return false;
+    offset = *block.freeBlocks[splitOrder].begin();
+    block.freeBlocks[splitOrder].erase(block.freeBlocks[splitOrder].begin());
+    while(splitOrder > order) // keep the lower half, the upper half becomes a free block one order down
+    {
+        --splitOrder;
+        block.freeBlocks[splitOrder].insert(offset + BlockBytes(splitOrder));
+    }
+    block.allocatedOrder[offset] = order;
+    return true;
+}
+mGLu::BufferRange mGLu::BufferArena::Allocate(GLsizeiptr size, const void* data)
+{
+    if(size <= 0)
+        return {};
+    const unsigned int order = OrderOf(size);
+    GLintptr offset = 0;
+    __block *owner = nullptr;
+    for(__block &block : blocks)
+        if(order <= block.maxOrder && AllocateFrom(block, order, offset))
+        {
+            owner = &block;
+            break;
+        }
+    if(!owner)
+    {
+        AddBlock(std::max(order, OrderOf(blockSize)));
+        owner = &blocks.back();
+        AllocateFrom(*owner, order, offset);
+    }
+    allocatedBytes += BlockBytes(order);
+    if(data)
+        glNamedBufferSubData(owner->buffer.GetName(), offset, size, data);
+    return {owner->buffer, offset, size};
+}
+void mGLu::BufferArena::Free(const BufferRange &range)
+{
+    if(!range.IsValid())
+        return;
+    const GLuint name = range.buffer.GetName();
+    for(__block &block : blocks)
+    {
+        if(block.buffer.GetName() != name)
+            continue;
+        auto allocated = block.allocatedOrder.find(range.offset);
+        if(allocated == block.allocatedOrder.end())
+            break;
+        unsigned int order = allocated->second;
+        GLintptr offset = range.offset;
+        block.allocatedOrder.erase(allocated);
+        allocatedBytes -= BlockBytes(order);
+        while(order < block.maxOrder) // merge with the buddy for as long as it is free too
+        {
+            const GLintptr buddy = offset ^ BlockBytes(order);
+            auto freeBuddy = block.freeBlocks[order].find(buddy);
+            if(freeBuddy == block.freeBlocks[order].end())
+                break;
+            block.freeBlocks[order].erase(freeBuddy);
+            offset = std::min(offset, buddy);
+            ++order;
+        }
+        block.freeBlocks[order].insert(offset);
+        return;
+    }
+    std::fputs("BufferArena: Error: tried freeing a range that was not allocated from this arena\n", stderr);
+}
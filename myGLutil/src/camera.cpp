@@ -5,6 +5,7 @@
 #include <cstdio>
 
 #include "camera.hpp"
+#include "glState.hpp"
 
 mGLu::Camera::Camera(int _xOffset, int _yOffset, int _width, int _height, bool useCustomFBO) : 
     xOffset(_xOffset), yOffset(_yOffset),
@@ -15,7 +16,7 @@ mGLu::Camera::Camera(int _xOffset, int _yOffset, int _width, int _height, bool u
         glCreateTextures(GL_TEXTURE_2D, 3,  &colorTex);
         glCreateFramebuffers(1, &fbo);
         
-        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        GLState::BindFramebuffer(fbo);
         glBindTexture(GL_TEXTURE_2D, colorTex);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -41,7 +42,7 @@ mGLu::Camera::Camera(int _xOffset, int _yOffset, int _width, int _height, bool u
         {
             std::fputs("Framebuffer incomplete", stderr);
         }
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        GLState::BindFramebuffer(0);
     }
 }
 void mGLu::Camera::SetSize(int _width, int _height)
@@ -65,4 +66,18 @@ GLuint mGLu::Camera::GetDepthTexture()
 GLuint mGLu::Camera::GetNormalTexture()
 {
     return normalTex;
+}
+mGLu::Frustum::Frustum(const glm::mat4 &viewProjection)
+{
+    // Gribb & Hartmann: the planes are sums and differences of the matrix rows
+    glm::vec4 rows[4];
+    for(int i = 0; i < 4; i++)
+        rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+    for(int i = 0; i < 3; i++)
+    {
+        planes[2*i] = rows[3] + rows[i];
+        planes[2*i + 1] = rows[3] - rows[i];
+    }
+    for(glm::vec4 &plane : planes)
+        plane /= glm::length(glm::vec3(plane));
 }
\ No newline at end of file
@@ -0,0 +1,202 @@
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <string>
+
+#include "window.hpp"
+#include "gpusort.hpp"
+
+static const char *__sortCommonCode = R"DENOM(
+layout(local_size_x = LOCAL_SIZE) in;
+struct KeyValue
+{
+    float key;
+    uint value;
+};
+layout(std430, binding = KEY_VALUE_BINDING) buffer KEY_VALUES
+{
+    KeyValue keyValues[];
+};
+layout(location = 0) uniform uint k;
+layout(location = 1) uniform uint j;
+bool OutOfOrder(KeyValue a, KeyValue b, uint i) // a sits at index i, b at i + j
+{
+    bool ascending = ((i & k) == 0) != DESCENDING;
+    return ascending ? a.key > b.key : a.key < b.key;
+}
+)DENOM";
+
+static const char *__sortGlobalCode = R"DENOM(
+void main()
+{
+    uint t = gl_GlobalInvocationID.x;
+    uint i = 2 * j * (t / j) + t % j;
+    KeyValue a = keyValues[i], b = keyValues[i + j];
+    if(OutOfOrder(a, b, i))
+    {
+        keyValues[i] = b;
+        keyValues[i + j] = a;
+    }
+}
+)DENOM";
+
+// k == 0 sorts every 2 * LOCAL_SIZE block completely, otherwise finishes stage k from step j down
+static const char *__sortLocalCode = R"DENOM(
+shared KeyValue localKeyValues[2 * LOCAL_SIZE];
+void main()
+{
+    const uint base = gl_WorkGroupID.x * 2 * LOCAL_SIZE;
+    const uint t = gl_LocalInvocationID.x;
+    localKeyValues[t] = keyValues[base + t];
+    localKeyValues[t + LOCAL_SIZE] = keyValues[base + t + LOCAL_SIZE];
+    barrier();
+
+    const uint firstStage = k == 0 ? 2 : k, lastStage = k == 0 ? 2 * LOCAL_SIZE : k;
+    for(uint stage = firstStage; stage <= lastStage; stage <<= 1)
+    {
+        for(uint step = k == 0 ? stage / 2 : j; step > 0; step >>= 1)
+        {
+            uint i = 2 * step * (t / step) + t % step;
+            KeyValue a = localKeyValues[i], b = localKeyValues[i + step];
+            bool ascending = (((base + i) & stage) == 0) != DESCENDING;
+            if(ascending ? a.key > b.key : a.key < b.key)
+            {
+                localKeyValues[i] = b;
+                localKeyValues[i + step] = a;
+            }
+            barrier();
+        }
+    }
+
+    keyValues[base + t] = localKeyValues[t];
+    keyValues[base + t + LOCAL_SIZE] = localKeyValues[t + LOCAL_SIZE];
+}
+)DENOM";
+
+static const char *__sortGatherCode = R"DENOM(
+layout(std430, binding = SRC_BINDING) readonly buffer SRC
+{
+    uint srcWords[];
+};
+layout(std430, binding = DST_BINDING) writeonly buffer DST
+{
+    uint dstWords[];
+};
+layout(location = 2) uniform uint elemWords;
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    uint srcI = keyValues[i].value;
+    if(srcI == 0xFFFFFFFFu)
+        return;
+    for(uint w = 0; w < elemWords; w++)
+        dstWords[i * elemWords + w] = srcWords[srcI * elemWords + w];
+}
+)DENOM";
+
+mGLu::GPUSorter::GPUSorter(const Window &window, GLuint maxElementCount, bool _descending, GLuint firstBindingIndex):
+    descending(_descending),
+    capacity(2 * localSize),
+    firstBinding(firstBindingIndex)
+{
+    while(capacity < maxElementCount)
+        capacity <<= 1;
+    keyValueBuffer = FixedBuffer(capacity * sizeof(KeyValue), nullptr, 0);
+
+    std::string defines =
+        "#define LOCAL_SIZE " + std::to_string(localSize) + "\n" +
+        "#define DESCENDING " + (descending ? "true" : "false") + "\n" +
+        "#define KEY_VALUE_BINDING " + std::to_string(firstBinding) + "\n" +
+        "#define SRC_BINDING " + std::to_string(firstBinding + 1) + "\n" +
+        "#define DST_BINDING " + std::to_string(firstBinding + 2) + "\n" +
+        __sortCommonCode;
+    localShader = ComputeShader(window, (defines + __sortLocalCode).c_str());
+    globalShader = ComputeShader(window, (defines + __sortGlobalCode).c_str());
+    gatherShader = ComputeShader(window, (defines + __sortGatherCode).c_str());
+}
+void mGLu::GPUSorter::Reset()
+{
+    float padKey = descending ? -std::numeric_limits<float>::infinity() : std::numeric_limits<float>::infinity();
+    GLuint pad[2] = {0, padValue};
+    std::memcpy(&pad[0], &padKey, sizeof(float));
+    glClearNamedBufferData(keyValueBuffer.GetName(), GL_RG32UI, GL_RG_INTEGER, GL_UNSIGNED_INT, pad);
+}
+void mGLu::GPUSorter::BindKeyValues(GLuint bindingIndex)
+{
+    keyValueBuffer.BindToSSBO(bindingIndex);
+}
+void mGLu::GPUSorter::Sort()
+{
+    keyValueBuffer.BindToSSBO(firstBinding);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    const GLuint localGroups = capacity / (2 * localSize);
+    localShader.Use();
+    glUniform1ui(0, 0);
+    localShader.Dispatch(localGroups);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    for(GLuint k = 4 * localSize; k <= capacity; k <<= 1)
+    {
+        GLuint j = k / 2;
+        globalShader.Use();
+        glUniform1ui(0, k);
+        for(; j > localSize; j >>= 1)
+        {
+            glUniform1ui(1, j);
+            globalShader.Dispatch(localGroups);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        }
+        localShader.Use();
+        glUniform1ui(0, k);
+        glUniform1ui(1, j);
+        localShader.Dispatch(localGroups);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+    if(validate)
+        Validate();
+}
+void mGLu::GPUSorter::Gather(Buffer &src, Buffer &dst, GLsizeiptr elemSize, GLintptr srcOffset)
+{
+    keyValueBuffer.BindToSSBO(firstBinding);
+    src.BindToSSBO(firstBinding + 1, src.GetSize() - srcOffset, srcOffset);
+    dst.BindToSSBO(firstBinding + 2);
+    gatherShader.Use();
+    glUniform1ui(2, elemSize / sizeof(GLuint));
+    gatherShader.Dispatch(capacity / localSize);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+}
+std::vector<mGLu::GPUSorter::KeyValue> mGLu::GPUSorter::ReadBack()
+{
+    std::vector<KeyValue> keyValues(capacity);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glGetNamedBufferSubData(keyValueBuffer.GetName(), 0, capacity * sizeof(KeyValue), keyValues.data());
+    return keyValues;
+}
+bool mGLu::GPUSorter::Validate()
+{
+    std::vector<KeyValue> keyValues = ReadBack();
+    std::vector<bool> valueSeen(capacity, false);
+    for(GLuint i = 0; i < capacity; i++)
+    {
+        if(i > 0 && (descending ? keyValues[i-1].key < keyValues[i].key : keyValues[i-1].key > keyValues[i].key))
+        {
+            std::fprintf(stderr, "GPUSorter: Error: keys at %u and %u are out of order (%f, %f)\n", i - 1, i, keyValues[i-1].key, keyValues[i].key);
+            return false;
+        }
+        GLuint value = keyValues[i].value;
+        if(value == padValue)
+            continue;
+        if(value >= capacity || valueSeen[value])
+        {
+            std::fprintf(stderr, "GPUSorter: Error: value %u at %u is out of range or duplicated\n", value, i);
+            return false;
+        }
+        valueSeen[value] = true;
+    }
+    return true;
+}
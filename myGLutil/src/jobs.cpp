@@ -0,0 +1,151 @@
+#include <cstdio>
+
+#include "jobs.hpp"
+
+static thread_local const mGLu::JobSystem *__currentSystem = nullptr; // pool the calling thread is a worker of
+static thread_local unsigned int __currentQueue = 0;
+
+mGLu::JobSystem::JobSystem(int workerCount)
+{
+    if(workerCount < 0)
+        workerCount = std::max<int>(std::thread::hardware_concurrency(), 1) - 1;
+    queues.resize(workerCount + 1);
+    for(std::unique_ptr<WorkerQueue> &queue : queues)
+        queue = std::make_unique<WorkerQueue>();
+    workers.reserve(workerCount);
+    for(int i = 0; i < workerCount; i++)
+        workers.emplace_back(&JobSystem::WorkerLoop, this, i + 1);
+}
+mGLu::JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stop = true;
+    }
+    wakeUp.notify_all();
+    for(std::thread &worker : workers)
+        worker.join();
+}
+mGLu::JobSystem::JobHandle mGLu::JobSystem::Submit(std::function<void()> func, std::initializer_list<JobHandle> dependencies)
+{
+    return Submit(std::move(func), std::vector<JobHandle>(dependencies));
+}
+mGLu::JobSystem::JobHandle mGLu::JobSystem::Submit(std::function<void()> func, const std::vector<JobHandle> &dependencies)
+{
+    JobHandle job = std::make_shared<Job>();
+    job->func = std::move(func);
+    for(const JobHandle &dependency : dependencies)
+    {
+        if(!dependency)
+            continue;
+        std::lock_guard<std::mutex> lock(dependency->mutex);
+        if(dependency->done)
+            continue;
+        job->pendingDependencies++;
+        dependency->dependents.push_back(job);
+    }
+    if(--job->pendingDependencies == 0)
+        Enqueue(job);
+    return job;
+}
+void mGLu::JobSystem::Wait(const JobHandle &job)
+{
+    while(!IsDone(job))
+    {
+        if(RunOne())
+            continue;
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wakeUp.wait(lock, [&]{ return queuedCount > 0 || IsDone(job); });
+    }
+}
+bool mGLu::JobSystem::IsDone(const JobHandle &job)
+{
+    std::lock_guard<std::mutex> lock(job->mutex);
+    return job->done;
+}
+void mGLu::JobSystem::Enqueue(JobHandle job)
+{
+    WorkerQueue &queue = *queues[CurrentQueue()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.push_back(std::move(job));
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex); // a sleeper checks queuedCount under this lock, so the wake up can not slip in between
+        queuedCount++;
+    }
+    wakeUp.notify_one();
+}
+mGLu::JobSystem::JobHandle mGLu::JobSystem::Pop(unsigned int queueIndex)
+{
+    WorkerQueue &queue = *queues[queueIndex];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if(queue.jobs.empty())
+        return nullptr;
+    JobHandle job = std::move(queue.jobs.back());
+    queue.jobs.pop_back();
+    queuedCount--;
+    return job;
+}
+mGLu::JobSystem::JobHandle mGLu::JobSystem::Steal(unsigned int thiefIndex)
+{
+    for(std::size_t i = 1; i < queues.size(); i++)
+    {
+        WorkerQueue &queue = *queues[(thiefIndex + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if(queue.jobs.empty())
+            continue;
+        JobHandle job = std::move(queue.jobs.front());
+        queue.jobs.pop_front();
+        queuedCount--;
+        return job;
+    }
+    return nullptr;
+}
+bool mGLu::JobSystem::RunOne()
+{
+    const unsigned int queueIndex = CurrentQueue();
+    JobHandle job = Pop(queueIndex);
+    if(!job)
+        job = Steal(queueIndex);
+    if(!job)
+        return false;
+    Run(job);
+    return true;
+}
+void mGLu::JobSystem::Run(const JobHandle &job)
+{
+    job->func();
+    job->func = nullptr; // releases captures early, handles may outlive the job by a lot
+    std::vector<JobHandle> dependents;
+    {
+        std::lock_guard<std::mutex> lock(job->mutex);
+        job->done = true;
+        dependents.swap(job->dependents);
+    }
+    for(JobHandle &dependent : dependents)
+        if(--dependent->pendingDependencies == 0)
+            Enqueue(std::move(dependent));
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wakeUp.notify_all(); // for threads waiting on this job
+}
+void mGLu::JobSystem::WorkerLoop(unsigned int queueIndex)
+{
+    __currentSystem = this;
+    __currentQueue = queueIndex;
+    while(true)
+    {
+        if(RunOne())
+            continue;
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wakeUp.wait(lock, [&]{ return queuedCount > 0 || stop; });
+        if(stop)
+            return;
+    }
+}
+unsigned int mGLu::JobSystem::CurrentQueue() const
+{
+    return __currentSystem == this ? __currentQueue : 0;
+}
@@ -4,6 +4,7 @@
 
 #include "shader.hpp"
 #include "window.hpp"
+#include "glState.hpp"
 
 #include "mesh.hpp"
 static const char *vertexShaderAttribPrefix = 
@@ -71,32 +72,47 @@ mGLu::Mesh::Mesh(mGLu::Mesh&& other) noexcept:
 mGLu::Mesh::~Mesh()
 {
     if(posVBO)
+    {
+        GLState::ForgetBuffer(posVBO);
         glDeleteBuffers(1, &posVBO);
+    }
     if(colorVBO)
+    {
+        GLState::ForgetBuffer(colorVBO);
         glDeleteBuffers(1, &colorVBO);
+    }
     if(normalVBO)
+    {
+        GLState::ForgetBuffer(normalVBO);
         glDeleteBuffers(1, &normalVBO);
+    }
     if(uvVBO)
+    {
+        GLState::ForgetBuffer(uvVBO);
         glDeleteBuffers(1, &uvVBO);
+    }
     if(EBO)
+    {
+        GLState::ForgetBuffer(EBO);
         glDeleteBuffers(1, &EBO);
+    }
 }
 void mGLu::Mesh::Draw(Shader shader, const TransformBuffer& transforms, GLenum drawMode)
 {
     const GLuint vao = GetVAO();
 
-    glVertexArrayVertexBuffer(vao, posBinding, posVBO, 0, sizeof(glm::vec3));
-    glVertexArrayVertexBuffer(vao, colorBinding, colorVBO, 0, sizeof(glm::vec4));
-    glVertexArrayVertexBuffer(vao, normalBinding, normalVBO, 0, sizeof(glm::vec3));
-    glVertexArrayVertexBuffer(vao, uvBinding, uvVBO, 0, sizeof(glm::vec2));
-    glVertexArrayVertexBuffer(vao, transformBinding, transforms.transformVBO, 0, sizeof(glm::mat4));
+    GLState::VertexArrayVertexBuffer(vao, posBinding, posVBO, 0, sizeof(glm::vec3));
+    GLState::VertexArrayVertexBuffer(vao, colorBinding, colorVBO, 0, sizeof(glm::vec4));
+    GLState::VertexArrayVertexBuffer(vao, normalBinding, normalVBO, 0, sizeof(glm::vec3));
+    GLState::VertexArrayVertexBuffer(vao, uvBinding, uvVBO, 0, sizeof(glm::vec2));
+    GLState::VertexArrayVertexBuffer(vao, transformBinding, transforms.transformVBO, 0, sizeof(glm::mat4));
     shader.Use();
 
-    glBindVertexArray(vao);
+    GLState::BindVertexArray(vao);
 
     if(currIndexN)
     {
-        glVertexArrayElementBuffer(vao, EBO);
+        GLState::VertexArrayElementBuffer(vao, EBO);
         glDrawElementsInstanced(drawMode, currIndexN, GL_UNSIGNED_INT, nullptr, transforms. currTransformN);
         return;
     }
@@ -1,75 +1,182 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
+#include <algorithm>
+#include <cstdint>
 #include <cstring>
+#include <filesystem>
 #include <string>
+#include <vector>
 
 #include "window.hpp"
 
 #include "shader.hpp"
-std::unordered_map<GLuint, unsigned int> mGLu::Shader::instanceCount{};
+#include "glState.hpp"
+mGLu::HandleRegistry<GLuint>& mGLu::Shader::Registry()
+{
+	static HandleRegistry<GLuint> registry;
+	return registry;
+}
 
-static GLuint __CreateShader(const char *vsCode, const char *fsCode, const char *gsCode)
+static GLuint __CompileStage(GLenum type, const char *code, const char *stageName)
 {
-	unsigned int vs = 0, fs = 0, gs = 0;
-	GLuint ID = 0;
-	if (vsCode)
+	GLuint stage = glCreateShader(type);
+	glShaderSource(stage, 1, &code, NULL);
+	glCompileShader(stage);
+	GLint compileStatus, logLen;
+	glGetShaderiv(stage, GL_COMPILE_STATUS, &compileStatus);
+	glGetShaderiv(stage, GL_INFO_LOG_LENGTH, &logLen);
+	if (logLen > 0)
 	{
-		vs = glCreateShader(GL_VERTEX_SHADER);
-		glShaderSource(vs, 1, &vsCode, NULL);
-		glCompileShader(vs);
-		GLint compileStatus, logLen;
-		glGetShaderiv(vs, GL_COMPILE_STATUS, &compileStatus);
-		glGetShaderiv(vs, GL_INFO_LOG_LENGTH, &logLen);
-		if (logLen > 0)
+		char log[logLen + 1];
+		glGetShaderInfoLog(stage, logLen + 1, 0, log);
+		std::fprintf(stderr, "%s Shader Compilation Error: %s", stageName, log);
+	}
+	return stage;
+}
+struct __stageSource
+{
+	GLenum type;
+	const char *code, *name;
+};
+
+static std::string __binaryCacheDirectory;
+static std::size_t __binaryCacheMaxPrograms = 0;
+struct __programBinaryHeader
+{
+	char magic[8] = {'m', 'G', 'L', 'u', 'P', 'B', 'I', 'N'};
+	std::uint64_t key = 0; // repeated in the file so a renamed file is not loaded for the wrong program
+	GLenum format = 0;
+	GLint length = 0;
+};
+static std::uint64_t __HashProgram(const __stageSource *stages, std::size_t count) // 64 bit FNV-1a over the driver and every stage
+{
+	std::uint64_t hash = 0xcbf29ce484222325ull;
+	auto add = [&](const void *data, std::size_t size){
+		for (std::size_t i = 0; i < size; i++)
+			hash = (hash ^ static_cast<const unsigned char*>(data)[i]) * 0x100000001b3ull;
+	};
+	auto addString = [&](const char *str){
+		add(str, std::strlen(str) + 1); // with the '\0', so moving text between strings changes the hash
+	};
+	addString(reinterpret_cast<const char*>(glGetString(GL_VENDOR)));
+	addString(reinterpret_cast<const char*>(glGetString(GL_RENDERER)));
+	addString(reinterpret_cast<const char*>(glGetString(GL_VERSION)));
+	for (std::size_t i = 0; i < count; i++)
+		if (stages[i].code)
 		{
-			char log[logLen + 1];
-			glGetShaderInfoLog(vs, logLen + 1, 0, log);
-			std::fprintf(stderr, "Vertex Shader Compilation Error: %s", log);
+			add(&stages[i].type, sizeof(GLenum));
+			addString(stages[i].code);
 		}
+	return hash;
+}
+static std::string __ProgramBinaryPath(std::uint64_t key) // empty if the cache is off or unusable
+{
+	GLint formatCount = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+	if (__binaryCacheDirectory.empty() || formatCount == 0)
+		return {};
+	char name[32];
+	std::snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+	return __binaryCacheDirectory + "/" + name;
+}
+static GLuint __LoadProgramBinary(const std::string &path, std::uint64_t key) // 0 if there is no usable binary
+{
+	std::FILE *file = std::fopen(path.c_str(), "rb");
+	if (!file)
+		return 0;
+	__programBinaryHeader header, expected;
+	std::vector<char> binary;
+	bool read = std::fread(&header, sizeof(header), 1, file) == 1 && std::memcmp(header.magic, expected.magic, sizeof(header.magic)) == 0
+		&& header.key == key && header.length > 0;
+	if (read)
+	{
+		binary.resize(header.length);
+		read = std::fread(binary.data(), 1, binary.size(), file) == binary.size();
 	}
-	if (fsCode)
+	std::fclose(file);
+	if (!read) // truncated or from another build of the cache, it would only be tried and rejected again
 	{
-		fs = glCreateShader(GL_FRAGMENT_SHADER);
-		glShaderSource(fs, 1, &fsCode, NULL);
-		glCompileShader(fs);
-		GLint compileStatus, logLen;
-		glGetShaderiv(fs, GL_COMPILE_STATUS, &compileStatus);
-		glGetShaderiv(fs, GL_INFO_LOG_LENGTH, &logLen);
-		if (logLen > 0)
-		{
-			char log[logLen + 1];
-			glGetShaderInfoLog(vs, logLen + 1, 0, log);
-			std::fprintf(stderr, "Fragment Shader Compilation Error: %s", log);
-		}
+		std::remove(path.c_str());
+		return 0;
 	}
-	if (gsCode)
+	GLuint ID = glCreateProgram();
+	glProgramBinary(ID, header.format, binary.data(), header.length);
+	GLint linkStatus = GL_FALSE;
+	glGetProgramiv(ID, GL_LINK_STATUS, &linkStatus);
+	if (linkStatus != GL_TRUE) // driver update or a different GPU, rejecting the binary is allowed at any time
 	{
-		gs = glCreateShader(GL_GEOMETRY_SHADER);
-		glShaderSource(gs, 1, &gsCode, NULL);
-		glCompileShader(gs);
-		GLint compileStatus, logLen;
-		glGetShaderiv(gs, GL_COMPILE_STATUS, &compileStatus);
-		glGetShaderiv(gs, GL_INFO_LOG_LENGTH, &logLen);
-		if (logLen > 0)
-		{
-			char log[logLen + 1];
-			glGetShaderInfoLog(vs, logLen + 1, 0, log);
-			std::fprintf(stderr, "Geometry Shader Compilation Error: %s", log);
-		}
+		glDeleteProgram(ID);
+		std::remove(path.c_str());
+		return 0;
+	}
+	std::error_code error;
+	std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error); // marks it as recently used for pruning
+	return ID;
+}
+static void __StoreProgramBinary(GLuint ID, const std::string &path, std::uint64_t key)
+{
+	__programBinaryHeader header;
+	header.key = key;
+	glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &header.length);
+	if (header.length <= 0)
+		return;
+	std::vector<char> binary(header.length);
+	glGetProgramBinary(ID, header.length, &header.length, &header.format, binary.data());
+
+	std::error_code error;
+	std::filesystem::create_directories(__binaryCacheDirectory, error);
+	const std::string tempPath = path + ".tmp"; // written aside and renamed, so a crash never leaves half a binary
+	std::FILE *file = std::fopen(tempPath.c_str(), "wb");
+	if (!file)
+	{
+		std::fprintf(stderr, "Shader: Error: could not write the program binary %s\n", tempPath.c_str());
+		return;
 	}
-	ID = glCreateProgram();
-	if (vs)
+	const bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 && std::fwrite(binary.data(), 1, header.length, file) == (std::size_t)header.length;
+	std::fclose(file);
+	if (written)
 	{
-		glAttachShader(ID, vs);
+		std::filesystem::rename(tempPath, path, error);
+		if (error) // renaming onto an existing file fails on some platforms
+		{
+			std::filesystem::remove(path, error);
+			std::filesystem::rename(tempPath, path, error);
+		}
 	}
-	if (fs)
+	if (!written || error)
 	{
-		glAttachShader(ID, fs);
+		std::fprintf(stderr, "Shader: Error: could not write the program binary %s\n", path.c_str());
+		std::filesystem::remove(tempPath, error);
 	}
-	if (gs)
+}
+static void __PruneProgramBinaries() // deletes the least recently used binaries beyond __binaryCacheMaxPrograms, every source edit leaves one behind
+{
+	std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>> binaries;
+	std::error_code error;
+	for (const std::filesystem::directory_entry &entry : std::filesystem::directory_iterator(__binaryCacheDirectory, error))
+		if (entry.path().extension() == ".bin")
+			binaries.emplace_back(entry.last_write_time(error), entry.path());
+	if (binaries.size() <= __binaryCacheMaxPrograms)
+		return;
+	std::sort(binaries.begin(), binaries.end());
+	for (std::size_t i = 0; i < binaries.size() - __binaryCacheMaxPrograms; i++)
+		std::filesystem::remove(binaries[i].second, error);
+}
+
+static GLuint __LinkStages(const __stageSource *stages, std::size_t count, bool retrievable, bool &linked)
+{
+	GLuint ID = glCreateProgram();
+	if (retrievable)
+		glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	for (std::size_t i = 0; i < count; i++)
 	{
-		glAttachShader(ID, gs);
+		if (stages[i].code)
+		{
+			GLuint compiled = __CompileStage(stages[i].type, stages[i].code, stages[i].name);
+			glAttachShader(ID, compiled);
+			glDeleteShader(compiled); // only flagged, it lives as long as the program
+		}
 	}
 	glLinkProgram(ID);
 	GLint linkStatus, logLen;
@@ -79,63 +186,106 @@ static GLuint __CreateShader(const char *vsCode, const char *fsCode, const char
 	{
 		char log[logLen + 1];
 		glGetProgramInfoLog(ID, logLen + 1, 0, log);
-		std::fprintf(stderr, "Geometry Shader Linking Error: %s", log);
+		std::fprintf(stderr, "Shader Linking Error: %s", log);
 	}
-	//puts(vsCode);
-	//puts(fsCode);
+	linked = linkStatus == GL_TRUE;
 	return ID;
 }
+static GLuint __CreateProgram(const __stageSource *stages, std::size_t count) // from the binary cache if it has this exact program
+{
+	const std::uint64_t key = __HashProgram(stages, count);
+	const std::string path = __ProgramBinaryPath(key);
+	if (!path.empty())
+		if (GLuint ID = __LoadProgramBinary(path, key))
+			return ID;
+	bool linked = false;
+	GLuint ID = __LinkStages(stages, count, !path.empty(), linked);
+	if (linked && !path.empty()) // failed programs are never cached
+		__StoreProgramBinary(ID, path, key);
+	return ID;
+}
+static GLuint __CreateShader(const char *vsCode, const char *fsCode, const char *gsCode, const char *tcsCode = nullptr, const char *tesCode = nullptr)
+{
+	const __stageSource stages[] = {
+		{GL_VERTEX_SHADER, vsCode, "Vertex"},
+		{GL_TESS_CONTROL_SHADER, tcsCode, "Tessellation Control"},
+		{GL_TESS_EVALUATION_SHADER, tesCode, "Tessellation Evaluation"},
+		{GL_GEOMETRY_SHADER, gsCode, "Geometry"},
+		{GL_FRAGMENT_SHADER, fsCode, "Fragment"},
+	};
+	return __CreateProgram(stages, sizeof(stages) / sizeof(stages[0]));
+}
+static GLuint __CreateComputeShader(const char *csCode)
+{
+	const __stageSource stage = {GL_COMPUTE_SHADER, csCode, "Compute"};
+	return __CreateProgram(&stage, 1);
+}
+
+void mGLu::Shader::SetBinaryCacheDirectory(const char *directory, std::size_t maxPrograms)
+{
+	__binaryCacheDirectory = directory ? directory : "";
+	__binaryCacheMaxPrograms = maxPrograms;
+	if (!__binaryCacheDirectory.empty()) // once per process, what this run stores is only pruned by the next one
+		__PruneProgramBinaries();
+}
 
 mGLu::Shader::Shader()
 {
 	
 }
 mGLu::Shader::Shader(const Shader& other) :
+	handle(other.handle),
 	ID(other.ID)
 {
-	if (ID != 0)
-	{
-		++instanceCount[ID];
-	}
+	Registry().Retain(handle);
 }
 mGLu::Shader& mGLu::Shader::operator=(const Shader& other)
 {
+	Registry().Retain(other.handle);
+	Release();
+	handle = other.handle;
 	ID = other.ID;
-	if (ID != 0)
-	{
-		++instanceCount[ID];
-	}
 	return *this;
 }
 mGLu::Shader::Shader(Shader&& other) noexcept:
+	handle(other.handle),
 	ID(other.ID)
 {
+	other.handle = {};
 	other.ID = 0;
-	if (ID != 0)
+}
+mGLu::Shader& mGLu::Shader::operator=(Shader&& other) noexcept
+{
+	if (this != &other)
 	{
-		++instanceCount[ID];
+		Release();
+		handle = other.handle;
+		ID = other.ID;
+		other.handle = {};
+		other.ID = 0;
 	}
+	return *this;
 }
 mGLu::Shader::~Shader()
 {
-	if (!ID)
-		return;
-	if (--instanceCount[ID] == 0)
+	Release();
+}
+void mGLu::Shader::Release()
+{
+	GLuint program = 0;
+	if (Registry().Release(handle, program))
 	{
-		instanceCount.erase(ID);
-		
-		glDeleteProgram(ID);
+		GLState::ForgetProgram(program);
+		glDeleteProgram(program);
 	}
-	
+	handle = {};
+	ID = 0;
 }
 mGLu::Shader::Shader(const char* const vsCode, const char* const fsCode,
-			const char* const gsCode)
+			const char* const gsCode) :
+	Shader(__CreateShader(vsCode, fsCode, gsCode))
 {
-	ID = __CreateShader(vsCode, fsCode, gsCode);
-	if (ID != 0)
-	{
-		++instanceCount[ID];
-	}
+
 }
 mGLu::Shader::Shader(const Window &window, const char* const vsCode, const char* const fsCode, const char* const gsCode)
 {
@@ -161,15 +311,55 @@ mGLu::Shader::Shader(const Window &window, const char* const vsCode, const char*
 	}
 	ID = __CreateShader(passVS, passFS, passGS);
 	if (ID != 0)
-	{
-		++instanceCount[ID];
-	}
+		handle = Registry().Create(ID);
+}
+mGLu::Shader::Shader(GLuint programID) :
+	ID(programID)
+{
+	if (ID != 0)
+		handle = Registry().Create(ID);
 }
 GLuint mGLu::Shader::GetID() const
 {
 	return ID;
 }
+mGLu::Handle mGLu::Shader::GetHandle() const
+{
+	return handle;
+}
 void mGLu::Shader::Use() const
 {
-	glUseProgram(ID);
+	GLState::UseProgram(ID);
+}
+
+
+mGLu::TessellationShader::TessellationShader()
+{
+
+}
+mGLu::TessellationShader::TessellationShader(const Window &window, const char* const vsCode, const char* const tcsCode, const char* const tesCode,
+			const char* const fsCode, const char* const gsCode) :
+	Shader(__CreateShader(
+		(std::string(window.GetShaderPrefix(nullptr)) + vsCode).c_str(),
+		(std::string(window.GetShaderPrefix(nullptr)) + fsCode).c_str(),
+		gsCode ? (std::string(window.GetShaderPrefix(nullptr)) + gsCode).c_str() : nullptr,
+		(std::string(window.GetShaderPrefix(nullptr)) + tcsCode).c_str(),
+		(std::string(window.GetShaderPrefix(nullptr)) + tesCode).c_str()))
+{
+
+}
+
+mGLu::ComputeShader::ComputeShader()
+{
+
+}
+mGLu::ComputeShader::ComputeShader(const Window &window, const char* const csCode) :
+	Shader(__CreateComputeShader((std::string(window.GetShaderPrefix(nullptr)) + csCode).c_str()))
+{
+
+}
+void mGLu::ComputeShader::Dispatch(GLuint groupsX, GLuint groupsY, GLuint groupsZ) const
+{
+	Use();
+	glDispatchCompute(groupsX, groupsY, groupsZ);
 }
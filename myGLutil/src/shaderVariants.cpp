@@ -0,0 +1,81 @@
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <cstdio>
+
+#include "shaderVariants.hpp"
+#include "glState.hpp"
+
+mGLu::ShaderVariants::ShaderVariants()
+{
+
+}
+mGLu::ShaderVariants::ShaderVariants(std::initializer_list<ShaderOption> _options, Builder _builder, Initializer _initializer):
+    options(_options),
+    builder(std::move(_builder)),
+    initializer(std::move(_initializer))
+{
+    std::uint64_t placeValue = 1;
+    for(ShaderOption &option : options)
+    {
+        option.valueCount = std::max(option.valueCount, 1u);
+        option.defaultValue = std::min(option.defaultValue, option.valueCount - 1);
+        placeValues.push_back(placeValue);
+        placeValue *= option.valueCount;
+    }
+    if(placeValue > UINT32_MAX)
+        std::fputs("ShaderVariants: Error: the options have more combinations than a Key can hold\n", stderr);
+}
+mGLu::ShaderVariants::Key mGLu::ShaderVariants::GetDefaultKey() const
+{
+    Key key = 0;
+    for(std::size_t i = 0; i < options.size(); i++)
+        key += options[i].defaultValue * placeValues[i];
+    return key;
+}
+mGLu::ShaderVariants::Key mGLu::ShaderVariants::With(Key key, unsigned int option, unsigned int value) const
+{
+    if(option >= options.size())
+        return key;
+    value = std::min(value, options[option].valueCount - 1);
+    return key - GetValue(key, option) * placeValues[option] + value * placeValues[option];
+}
+unsigned int mGLu::ShaderVariants::GetValue(Key key, unsigned int option) const
+{
+    return option < options.size() ? key / placeValues[option] % options[option].valueCount : 0;
+}
+std::string mGLu::ShaderVariants::GetDefines(Key key) const
+{
+    std::string defines;
+    for(unsigned int i = 0; i < options.size(); i++)
+    {
+        defines += "#define ";
+        defines += options[i].name;
+        defines += ' ';
+        defines += std::to_string(GetValue(key, i));
+        defines += '\n';
+    }
+    return defines;
+}
+const mGLu::Shader& mGLu::ShaderVariants::Get(Key key)
+{
+    Precompile(key);
+    return variants[key];
+}
+void mGLu::ShaderVariants::Precompile(Key key)
+{
+    if(variants.count(key) || !builder)
+        return;
+    Shader &shader = variants[key] = builder(key, GetDefines(key));
+    if(initializer)
+    {
+        const GLuint previous = GLState::GetProgram(); // may be called between draws, which must not notice
+        shader.Use();
+        initializer(shader);
+        GLState::UseProgram(previous);
+    }
+}
+std::size_t mGLu::ShaderVariants::GetCompiledCount() const
+{
+    return variants.size();
+}
@@ -6,10 +6,12 @@
 
 #include "shader.hpp"
 #include "camera.hpp"
+#include "glState.hpp"
 
 #include "window.hpp"
 static const char* __DefaultWindowShaderPrefix = R"DENOM(
 #version XX0
+#extension GL_ARB_shader_draw_parameters : enable
 struct _mGLuGlobal{
 		mat4 projection;
 		mat4 view;
@@ -131,12 +133,39 @@ void mGLu::Window::StartMainLoop()
 		mousePos = {(float)mousePosX/width*2-1, -((float)mousePosY/height*2-1)};
 		mouseScroll = _mouseScroll[window];
 		_mouseScroll[window] = {0,0};
+		if(fixedTimeStep > 0.f)
+			RunFixedSteps();
 		Update();
+		GLState::EndFrame();
 		glfwSwapBuffers(window);
 		glfwPollEvents();
 		
 	}
 }
+void mGLu::Window::SetFixedTimeStep(float step)
+{
+	fixedTimeStep = step;
+	fixedAccumulator = 0.f;
+	fixedTickCount = 0;
+	fixedTimeOffset = mainLoopTime; // the simulation clock continues from here, so spawn timers and the like do not jump
+}
+void mGLu::Window::RunFixedSteps()
+{
+	fixedAccumulator += deltaTime;
+	if(fixedAccumulator > fixedTimeStep * maxFixedStepsPerFrame)
+		fixedAccumulator = fixedTimeStep * maxFixedStepsPerFrame;
+	const float frameDeltaTime = deltaTime, frameTime = mainLoopTime;
+	deltaTime = fixedTimeStep;
+	while(fixedAccumulator >= fixedTimeStep)
+	{
+		fixedAccumulator -= fixedTimeStep;
+		mainLoopTime = fixedTimeOffset + fixedTickCount * (double)fixedTimeStep; // multiplied rather than summed up, so it does not drift
+		FixedUpdate();
+		fixedTickCount++;
+	}
+	deltaTime = frameDeltaTime;
+	mainLoopTime = frameTime;
+}
 void mGLu::Window::UpdateSharedShaderVars()
 {
 	sharedShaderVars.data.deltaTime = DeltaTime();
@@ -145,9 +174,9 @@ void mGLu::Window::UpdateSharedShaderVars()
 }
 void mGLu::Window::UseCamera(mGLu::Camera &camera)
 {
-	glBindFramebuffer(GL_FRAMEBUFFER, camera.fbo);
-    glViewport(camera.xOffset, camera.yOffset, camera.width, camera.height);
-	glScissor(camera.xOffset, camera.yOffset, camera.width, camera.height);
+	GLState::BindFramebuffer(camera.fbo);
+	GLState::Viewport(camera.xOffset, camera.yOffset, camera.width, camera.height);
+	GLState::Scissor(camera.xOffset, camera.yOffset, camera.width, camera.height);
     sharedShaderVars.data.projection = camera.projection;
     sharedShaderVars.data.view = camera.view;
 }
@@ -0,0 +1,119 @@
+#pragma once
+const char *oitCompositeVScode = R"DENOM(
+void main()
+{
+    const vec2 positions[3] = vec2[](vec2(-1, -1), vec2(3, -1), vec2(-1, 3));
+    gl_Position = vec4(positions[gl_VertexID], 0, 1);
+}
+)DENOM";
+const char *oitCompositeFScode = R"DENOM(
+layout(binding = 0) uniform sampler2D accumColor;
+layout(binding = 1) uniform sampler2D accumAlpha;
+layout(binding = 2) uniform sampler2D revealage;
+
+layout(location = 0, index = 0) out vec4 outCol;
+layout(location = 0, index = 1) out vec4 outAlpha;
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    vec3 coverage = vec3(1) - texelFetch(revealage, texel, 0).rgb;
+    if(all(lessThan(coverage, vec3(1./1024))))
+        discard;
+    vec3 color = texelFetch(accumColor, texel, 0).rgb / max(texelFetch(accumAlpha, texel, 0).rgb, vec3(1e-5));
+    outCol = vec4(color, 1);
+    outAlpha = vec4(coverage, 1);
+}
+)DENOM";
+
+// Weighted blended order independent transparency (McGuire & Bavoil) with one coverage value per colour channel,
+// so it composites the same per-channel alpha the dual-source blended path uses.
+// Targets: accumulated weighted premultiplied colour, accumulated weighted alpha and the product of (1 - alpha).
+// Shaders drawn between Begin() and End() write those three to locations 0, 1 and 2.
+class WeightedBlendedOIT
+{
+    GLuint fbo = 0;
+    GLuint textures[4] = {}; // accumColor, accumAlpha, revealage, depth
+    glm::ivec2 size{0, 0};
+    GLint prevFramebuffer = 0;
+    GLint prevBlendFunc[4] = {}; // src rgb, dst rgb, src alpha, dst alpha
+    mGLu::Drawable composite;
+
+    void Resize(glm::ivec2 newSize)
+    {
+        if(fbo)
+        {
+            mGLu::GLState::ForgetFramebuffer(fbo);
+            glDeleteFramebuffers(1, &fbo);
+            glDeleteTextures(4, textures);
+        }
+        size = newSize;
+        glCreateFramebuffers(1, &fbo);
+        glCreateTextures(GL_TEXTURE_2D, 4, textures);
+        const GLenum formats[4] = {GL_RGBA16F, GL_RGBA16F, GL_RGBA16F, GL_DEPTH24_STENCIL8}; // depth has to match the default framebuffer for the blit
+        for(int i = 0; i < 4; i++)
+        {
+            glTextureStorage2D(textures[i], 1, formats[i], size.x, size.y);
+            glTextureParameteri(textures[i], GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTextureParameteri(textures[i], GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        }
+        for(int i = 0; i < 3; i++)
+            glNamedFramebufferTexture(fbo, GL_COLOR_ATTACHMENT0 + i, textures[i], 0);
+        glNamedFramebufferTexture(fbo, GL_DEPTH_STENCIL_ATTACHMENT, textures[3], 0);
+
+        const GLenum drawBuffers[3] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2};
+        glNamedFramebufferDrawBuffers(fbo, 3, drawBuffers);
+        if(glCheckNamedFramebufferStatus(fbo, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::fputs("WeightedBlendedOIT: Error: framebuffer incomplete\n", stderr);
+    }
+public:
+    WeightedBlendedOIT(const mGLu::Window *window)
+    {
+        composite.vao = mGLu::VAO();
+        composite.shader = mGLu::Shader(*window, oitCompositeVScode, oitCompositeFScode);
+    }
+    WeightedBlendedOIT(const WeightedBlendedOIT&) = delete;
+    ~WeightedBlendedOIT()
+    {
+        if(fbo)
+        {
+            mGLu::GLState::ForgetFramebuffer(fbo);
+            glDeleteFramebuffers(1, &fbo);
+            glDeleteTextures(4, textures);
+        }
+    }
+    void Begin(glm::ivec2 viewportSize) // takes over the depth of what was drawn so far, transparent geometry only tests against it
+    {
+        if(viewportSize != size)
+            Resize(viewportSize);
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &prevFramebuffer);
+        glGetIntegerv(GL_BLEND_SRC_RGB, &prevBlendFunc[0]);
+        glGetIntegerv(GL_BLEND_DST_RGB, &prevBlendFunc[1]);
+        glGetIntegerv(GL_BLEND_SRC_ALPHA, &prevBlendFunc[2]);
+        glGetIntegerv(GL_BLEND_DST_ALPHA, &prevBlendFunc[3]);
+        glBlitNamedFramebuffer(prevFramebuffer, fbo, 0, 0, size.x, size.y, 0, 0, size.x, size.y, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+        const float zero[4] = {0.f, 0.f, 0.f, 0.f}, one[4] = {1.f, 1.f, 1.f, 1.f};
+        glClearNamedFramebufferfv(fbo, GL_COLOR, 0, zero);
+        glClearNamedFramebufferfv(fbo, GL_COLOR, 1, zero);
+        glClearNamedFramebufferfv(fbo, GL_COLOR, 2, one);
+
+        mGLu::GLState::BindDrawFramebuffer(fbo);
+        glDepthMask(GL_FALSE);
+        glBlendFunci(0, GL_ONE, GL_ONE);
+        glBlendFunci(1, GL_ONE, GL_ONE);
+        glBlendFunci(2, GL_ZERO, GL_ONE_MINUS_SRC_COLOR);
+    }
+    void End() // composites the accumulated layers over the framebuffer that was bound in Begin()
+    {
+        mGLu::GLState::BindDrawFramebuffer(prevFramebuffer);
+        glBlendFunc(GL_SRC1_COLOR, GL_ONE_MINUS_SRC1_COLOR);
+        glDisable(GL_DEPTH_TEST);
+        glBindTextureUnit(0, textures[0]);
+        glBindTextureUnit(1, textures[1]);
+        glBindTextureUnit(2, textures[2]);
+        composite.Draw(3);
+        glEnable(GL_DEPTH_TEST);
+        glDepthMask(GL_TRUE);
+        glBlendFuncSeparate(prevBlendFunc[0], prevBlendFunc[1], prevBlendFunc[2], prevBlendFunc[3]);
+    }
+};
@@ -1,15 +1,30 @@
 #pragma once
 
 const char *playerVSCode = R"DENOM(
-layout(location = 0) uniform vec3 pos = vec3(0);
-layout(location = 1) uniform float scale = 1;
+#ifdef GL_ARB_shader_draw_parameters
+#define DRAW_ID gl_DrawIDARB
+#else
+#define DRAW_ID 0
+#endif
+struct PlayerDraw
+{
+    vec4 posScale;
+    vec4 color;
+};
+layout(std430, binding = 0) readonly buffer PLAYER_DRAWS // RenderQueue::drawDataBinding
+{
+    PlayerDraw playerDraws[];
+};
 out vec3 viewNormal;
 out vec3 viewPos;
+flat out vec3 color;
 void main()
 {
+    const PlayerDraw draw = playerDraws[DRAW_ID];
+    color = draw.color.rgb;
     mat3 normalMat = mat3(mGLuGlobal.view);
     viewNormal = normalize(normalMat * inPos);
-    const vec3 worldPos = pos + inPos*scale;
+    const vec3 worldPos = draw.posScale.xyz + inPos*draw.posScale.w;
     viewPos = vec3(mGLuGlobal.view * vec4(worldPos, 1));
     gl_Position = mGLuGlobal.projection * vec4(viewPos,1);
 }
@@ -101,14 +116,12 @@ ColorAlpha Blend(vec3 colA, vec3 alphaA, vec3 colB, vec3 alphaB)
 layout(location = 2) uniform vec3 spec = vec3(0.6);
 layout(location = 3) uniform vec3 ambient = vec3(0.005);
 layout(location = 4) uniform float gloss = 32;
-layout(location = 5) uniform vec3 color = vec3(1);
-layout(location = 6) uniform bool usePhong = false;
-layout(location = 7) uniform bool doWaterOcclusion = true;
 layout(location = 8) uniform float waterAbsorbance = 0.02f;
 layout(location = 9) uniform vec3 waterCol = vec3(0.36, 0.61, 1);
 
 in vec3 viewNormal;
 in vec3 viewPos;
+flat in vec3 color;
 
 out vec4 outCol;
 out vec4 outAlpha;
@@ -118,7 +131,7 @@ void main()
     Lighting light;
     light.diffuse = light.specular = vec3(0);
 
-    for(uint i = 0; i < pointLightN; i++)
+    for(uint i = 0; i < LIGHT_COUNT; i++)
     {
         vec3 lPos = vec3(mGLuGlobal.view * vec4(pointLights[i].pos,1));
         vec3 lCol = pointLights[i].col * pointLights[i].intensity;
@@ -129,16 +142,17 @@ void main()
         float fallof = 1/(lDistanceSqr+1);
 
         Lighting newLight;
-        if(usePhong)
-            newLight = CalcPhong(
-                viewDir,
-                lCol * fallof, lDir, ambient,
-                viewNormal, color, spec, gloss);
-        else
-            newLight = CalcLighting(
-                viewDir,
-                lCol * fallof, lDir, ambient,
-                viewNormal, color, spec, gloss);
+#if USE_PHONG
+        newLight = CalcPhong(
+            viewDir,
+            lCol * fallof, lDir, ambient,
+            viewNormal, color, spec, gloss);
+#else
+        newLight = CalcLighting(
+            viewDir,
+            lCol * fallof, lDir, ambient,
+            viewNormal, color, spec, gloss);
+#endif
         light.diffuse += newLight.diffuse;
         light.specular += newLight.specular;
     }
@@ -146,8 +160,9 @@ void main()
     vec3 waterOpacity = BeerLambertOpacity(waterAbsorbance * (vec3(1) - waterCol), length(viewPos));
 
     ColorAlpha blend = Blend(vec3(1), light.specular, light.diffuse, vec3(1));
-    if(doWaterOcclusion)
-        blend.color = (vec3(1)-waterOpacity)*blend.color;
+#if WATER_OCCLUSION
+    blend.color = (vec3(1)-waterOpacity)*blend.color;
+#endif
     outCol = vec4(blend.color,1);
     outAlpha = vec4(blend.alpha,1);
 }
@@ -155,43 +170,66 @@ void main()
 class PlayerModel
 {
     mGLu::Drawable model;
+    enum Option : unsigned int { UsePhong, WaterOcclusion, LightCount };
+    mGLu::ShaderVariants shaders;
+    mGLu::ShaderVariants::Key shaderKey = 0;
+    struct __drawData
+    {
+        glm::vec4 posScale; // scale in w
+        glm::vec4 color;
+    } drawData;
 public:
-    bool doWaterOcclusion = true;
-    bool usePhong = false;
     glm::vec3 pos, col;
     float scale;
-    PlayerModel(const mGLu::Window *window, float _scale, glm::vec3 _pos, glm::vec3 _col, unsigned int subdiv):
+    PlayerModel(const mGLu::Window *window, float _scale, glm::vec3 _pos, glm::vec3 _col, unsigned int subdiv, mGLu::BufferArena &meshArena):
         pos(_pos),
         col(_col),
         scale(_scale)
     {
-        mGLu::VAO vao;
-        GLuint posBinding = vao.AddAttrib(GL_FLOAT, 3, "inPos");
+        mGLu::VAO vao = mGLu::VAO::FromFormat<mGLu::PositionFormat>(true);
 
         model.vao = vao;
 
         std::vector<glm::vec3> vertices;
         std::vector<GLuint> indices;
         GenerateSphere(vertices, indices, subdiv);
-        model.buffers.push_back(mGLu::FixedBuffer(vertices.size(), vertices.data()));
-        model.indexBuffer = mGLu::FixedBuffer(indices.size(), indices.data());
-
-        model.SetBinding(posBinding, 0, 0, sizeof(glm::vec3));
-
-        model.shader = mGLu::Shader(*window, (vao.GetShaderPrefix() + playerVSCode).c_str(), (std::string(lightBufferPrefixCode) + playerFSCode).c_str());
-        model.shader.Use();
+        model.SetBindings<mGLu::PositionFormat, mGLu::PositionLayout>(meshArena.Allocate(vertices.size(), vertices.data()));
+        model.SetIndexBuffer(meshArena.Allocate(indices.size(), indices.data()));
+
+        shaders = mGLu::ShaderVariants({{"USE_PHONG"}, {"WATER_OCCLUSION", 2, 1}, {"LIGHT_COUNT", maxPointLights + 1, maxPointLights}},
+            [window, vsPrefix = std::string(vao.GetShaderPrefix())](mGLu::ShaderVariants::Key, const std::string &defines){
+                return mGLu::Shader(*window, (defines + vsPrefix + playerVSCode).c_str(), (defines + lightBufferPrefixCode + playerFSCode).c_str());
+            });
+        shaderKey = shaders.GetDefaultKey();
         printf("%f\n", scale);
         
     }
-    void Draw()
+    void Submit(mGLu::RenderQueue &queue, glm::vec3 cameraPos)
     {
-        
-        model.shader.Use();
-        glUniform1f(1, scale);
-        glUniform3f(5, col.x, col.y, col.z);
-        glUniform3f(0, pos.x, pos.y, pos.z);
-        glUniform1i(6, usePhong);
-        glUniform1i(7, doWaterOcclusion);
-        model.DrawIndexed(model.indexBuffer.GetSize()/sizeof(GLuint));
+        model.shader = shaders.Get(shaderKey);
+        mGLu::RenderPacket packet;
+        packet.key = mGLu::RenderQueue::MakeKey(mGLu::RenderPass::Opaque, model, 0, glm::distance(cameraPos, pos));
+        packet.drawable = &model;
+        packet.command = mGLu::RenderQueue::IndexedCommand(model, model.indexRangeSize / sizeof(GLuint));
+        drawData = {glm::vec4(pos, scale), glm::vec4(col, 1)};
+        packet.drawData = &drawData;
+        packet.drawDataSize = sizeof(drawData);
+        queue.Submit(std::move(packet));
+    }
+    void ToggleUsePhong()
+    {
+        shaderKey = shaders.With(shaderKey, UsePhong, !shaders.GetValue(shaderKey, UsePhong));
+    }
+    void ToggleDoWaterOcclusion()
+    {
+        shaderKey = shaders.With(shaderKey, WaterOcclusion, !shaders.GetValue(shaderKey, WaterOcclusion));
+    }
+    void SetLightCount(unsigned int count) // the lights in the light buffer, up to maxPointLights
+    {
+        shaderKey = shaders.With(shaderKey, LightCount, count);
+    }
+    void PrecompileShaders(unsigned int lightCount) // the current variant with this many lights, the debug toggles compile theirs on first use
+    {
+        shaders.Precompile(shaders.With(shaderKey, LightCount, lightCount));
     }
 };
\ No newline at end of file
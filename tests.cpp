@@ -0,0 +1,343 @@
+#include <myGLutil.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <vector>
+#include "ballKernels.hpp"
+#include "ballGrid.hpp"
+
+// Checks of the game's CPU kernels and of myGLutil, built with make tests (add CXXFLAGS=-mavx2 for the AVX2 kernels).
+// Every failed check is reported to stderr, the exit code is the number of failed checks.
+static int failures = 0;
+static void Check(bool condition, const char *format, ...)
+{
+    if(condition)
+        return;
+    ++failures;
+    std::va_list args;
+    va_start(args, format);
+    std::fputs("FAILED: ", stderr);
+    std::vfprintf(stderr, format, args);
+    std::fputc('\n', stderr);
+    va_end(args);
+}
+static bool Near(float a, float b)
+{
+    return std::abs(a - b) <= 1e-5f * std::max({1.f, std::abs(a), std::abs(b)});
+}
+static std::vector<float> RandomFloats(std::mt19937 &rng, std::size_t count, float min, float max)
+{
+    std::uniform_real_distribution<float> dist(min, max);
+    std::vector<float> values(count);
+    for(float &value : values)
+        value = dist(rng);
+    return values;
+}
+
+// The kernels against the plain loops they replace, with counts that leave every possible remainder for the scalar tail
+static void TestBallKernels()
+{
+    std::mt19937 rng(5);
+    const float deltaY = 0.25f, minY = -15.f, maxY = 15.f, growth = 0.3f / (maxY - minY);
+    for(std::size_t count : {0, 1, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 33, 1003})
+    {
+        std::vector<float> posY = RandomFloats(rng, count, minY, maxY), scale = RandomFloats(rng, count, 0.1f, 2.f);
+        const std::vector<float> initScale = RandomFloats(rng, count, 0.1f, 2.f);
+        std::vector<float> refPosY = posY, refScale = scale;
+        std::vector<std::uint8_t> refFlags(count), removeFlags(count, 2);
+        std::size_t refRemoveCount = 0;
+        for(std::size_t i = 0; i < count; i++)
+        {
+            refPosY[i] += deltaY;
+            refFlags[i] = refPosY[i] + refScale[i] > maxY;
+            refRemoveCount += refFlags[i];
+            refScale[i] = initScale[i] * (1.f + growth * (refPosY[i] - minY));
+        }
+
+        const std::size_t removeCount = IntegrateBalls(posY.data(), scale.data(), initScale.data(), removeFlags.data(), count, deltaY, minY, maxY);
+        Check(removeCount == refRemoveCount, "IntegrateBalls(%zu balls) flagged %zu balls, expected %zu", count, removeCount, refRemoveCount);
+        for(std::size_t i = 0; i < count; i++)
+        {
+            Check(posY[i] == refPosY[i], "IntegrateBalls(%zu balls) posY[%zu] is %f, expected %f", count, i, posY[i], refPosY[i]);
+            Check(Near(scale[i], refScale[i]), "IntegrateBalls(%zu balls) scale[%zu] is %f, expected %f", count, i, scale[i], refScale[i]);
+            Check(removeFlags[i] == refFlags[i], "IntegrateBalls(%zu balls) removeFlags[%zu] is %u, expected %u", count, i, removeFlags[i], refFlags[i]);
+        }
+
+        const std::vector<float> posX = RandomFloats(rng, count, -25.f, 25.f), posZ = RandomFloats(rng, count, -37.5f, 37.5f);
+        std::vector<float> keys(count + 1, -1.f);
+        const float cameraX = 3.f, cameraY = -2.f, cameraZ = 40.f;
+        ComputeDepthKeys(posX.data(), posY.data(), posZ.data(), scale.data(), keys.data(), count, cameraX, cameraY, cameraZ);
+        for(std::size_t i = 0; i < count; i++)
+        {
+            const float dx = posX[i] - cameraX, dy = posY[i] - cameraY, dz = posZ[i] - cameraZ;
+            const float refKey = std::sqrt(dx*dx + dy*dy + dz*dz) - scale[i];
+            Check(Near(keys[i], refKey), "ComputeDepthKeys(%zu balls) keys[%zu] is %f, expected %f", count, i, keys[i], refKey);
+        }
+        Check(keys[count] == -1.f, "ComputeDepthKeys(%zu balls) wrote past the end", count);
+    }
+}
+
+// Nearest() and OverlapsSphere() against brute force, with balls and query points on both sides of the grid bounds
+// and with balls moved after the build, which only the slack keeps visible to the queries
+static void TestBallGrid()
+{
+    std::mt19937 rng(6);
+    const glm::vec3 minBounds(-25.f, -15.f, -37.5f), maxBounds(25.f, 15.f, 37.5f);
+    const float maxRadius = 2.f, margin = 2.f * maxRadius;
+    BallGrid grid;
+    grid.Resize(minBounds, maxBounds, maxRadius);
+
+    Check(grid.Nearest(glm::vec3(0.f)) == -1, "BallGrid::Nearest found a ball in an empty grid");
+    Check(!grid.OverlapsSphere(glm::vec3(0.f), 100.f), "BallGrid::OverlapsSphere hit a ball in an empty grid");
+
+    const std::size_t count = 500;
+    std::vector<float> posX = RandomFloats(rng, count, minBounds.x - margin, maxBounds.x + margin);
+    std::vector<float> posY = RandomFloats(rng, count, minBounds.y - margin, maxBounds.y + margin);
+    std::vector<float> posZ = RandomFloats(rng, count, minBounds.z - margin, maxBounds.z + margin);
+    const std::vector<float> scale = RandomFloats(rng, count, 0.1f, maxRadius);
+    std::uniform_real_distribution<float> queryX(minBounds.x - 20.f, maxBounds.x + 20.f), queryY(minBounds.y - 20.f, maxBounds.y + 20.f),
+        queryZ(minBounds.z - 20.f, maxBounds.z + 20.f), queryRadius(0.f, 6.f), move(-3.f, 3.f);
+
+    auto checkQueries = [&](const char *state){
+        for(int query = 0; query < 2000; query++)
+        {
+            const glm::vec3 point(queryX(rng), queryY(rng), queryZ(rng));
+            const float radius = queryRadius(rng);
+            float bestDistSqr = INFINITY;
+            bool overlaps = false;
+            for(std::size_t i = 0; i < count; i++)
+            {
+                const float dx = posX[i] - point.x, dy = posY[i] - point.y, dz = posZ[i] - point.z;
+                const float distSqr = dx*dx + dy*dy + dz*dz;
+                bestDistSqr = std::min(bestDistSqr, distSqr);
+                overlaps = overlaps || distSqr < (radius + scale[i]) * (radius + scale[i]);
+            }
+            float distSqr = -1.f;
+            const int nearest = grid.Nearest(point, &distSqr);
+            Check(nearest >= 0 && distSqr == bestDistSqr, "BallGrid::Nearest(%f, %f, %f) %s found ball %d at %f, the nearest is at %f",
+                  point.x, point.y, point.z, state, nearest, std::sqrt(distSqr), std::sqrt(bestDistSqr));
+            Check(grid.OverlapsSphere(point, radius) == overlaps, "BallGrid::OverlapsSphere(%f, %f, %f, radius %f) %s returned %d",
+                  point.x, point.y, point.z, radius, state, !overlaps);
+        }
+    };
+    grid.Rebuild(posX.data(), posY.data(), posZ.data(), scale.data(), count);
+    checkQueries("after the build");
+
+    for(std::size_t i = 0; i < count; i++)
+    {
+        posX[i] += move(rng);
+        posY[i] += move(rng);
+        posZ[i] += move(rng);
+    }
+    grid.SetSlack(grid.Drift(0, count));
+    checkQueries("with moved balls");
+}
+
+// Jobs only start after all their dependencies finished, ParallelFor hands every index to exactly one chunk
+static void TestJobSystem()
+{
+    for(int workerCount : {0, 1, 3})
+    {
+        mGLu::JobSystem jobs(workerCount);
+        for(int round = 0; round < 200; round++) // a diamond and a job depending on a finished one, in many interleavings
+        {
+            std::atomic<int> clock{0};
+            int top = -1, left = -1, right = -1, bottom = -1, late = -1;
+            mGLu::JobSystem::JobHandle topJob = jobs.Submit([&]{ top = clock++; });
+            mGLu::JobSystem::JobHandle leftJob = jobs.Submit([&]{ left = clock++; }, {topJob});
+            mGLu::JobSystem::JobHandle rightJob = jobs.Submit([&]{ right = clock++; }, {topJob, nullptr});
+            mGLu::JobSystem::JobHandle bottomJob = jobs.Submit([&]{ bottom = clock++; }, {leftJob, rightJob});
+            jobs.Wait(bottomJob);
+            mGLu::JobSystem::JobHandle lateJob = jobs.Submit([&]{ late = clock++; }, {topJob, bottomJob});
+            jobs.Wait(lateJob);
+            Check(mGLu::JobSystem::IsDone(topJob) && mGLu::JobSystem::IsDone(leftJob) && mGLu::JobSystem::IsDone(rightJob),
+                  "JobSystem(%d workers) reported a job done before its dependencies", workerCount);
+            Check(top == 0 && left > top && right > top && bottom > std::max(left, right) && late == 4,
+                  "JobSystem(%d workers) ran jobs out of dependency order: top %d, left %d, right %d, bottom %d, late %d",
+                  workerCount, top, left, right, bottom, late);
+        }
+
+        struct Range { std::size_t begin, end, grainSize; };
+        for(Range range : {Range{0, 0, 4}, Range{5, 3, 4}, Range{0, 1, 0}, Range{0, 1000, 1}, Range{7, 1000, 64}, Range{3, 100, 97}, Range{3, 100, 98},
+                           Range{3, 100, 500}, Range{0, 4096, 256}})
+        {
+            std::vector<std::atomic<int>> hits(range.end + 1);
+            std::atomic<int> badChunks{0};
+            jobs.ParallelFor(range.begin, range.end, range.grainSize, [&](std::size_t chunkBegin, std::size_t chunkEnd){
+                if(chunkBegin >= chunkEnd || chunkBegin < range.begin || chunkEnd > range.end || chunkEnd - chunkBegin > std::max<std::size_t>(range.grainSize, 1))
+                    badChunks++;
+                for(std::size_t i = chunkBegin; i < chunkEnd && i < hits.size(); i++)
+                    hits[i]++;
+            });
+            int wrongHits = 0;
+            for(std::size_t i = 0; i < hits.size(); i++)
+                wrongHits += hits[i] != (i >= range.begin && i < range.end ? 1 : 0);
+            Check(badChunks == 0 && wrongHits == 0, "JobSystem(%d workers) ParallelFor(%zu, %zu, grain %zu) made %d bad chunks and missed or repeated %d indices",
+                  workerCount, range.begin, range.end, range.grainSize, badChunks.load(), wrongHits);
+        }
+    }
+}
+
+// Buddy splits and merges of BufferArena, observable through offsets, the allocated bytes and how many buffers it needs
+static void TestBufferArena()
+{
+    mGLu::BufferArena arena(1024, 64);
+    Check(!arena.Allocate(0).IsValid(), "BufferArena::Allocate(0) returned a valid range");
+
+    const unsigned char data[100] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+    const mGLu::BufferRange a = arena.Allocate(1), b = arena.Allocate(64), c = arena.Allocate(100, data), d = arena.Allocate(256), e = arena.Allocate(300);
+    Check(a.offset == 0 && b.offset == 64 && c.offset == 128 && d.offset == 256 && e.offset == 512,
+          "BufferArena split 1024 bytes into %ld, %ld, %ld, %ld, %ld instead of 0, 64, 128, 256, 512", (long)a.offset, (long)b.offset, (long)c.offset,
+          (long)d.offset, (long)e.offset);
+    Check(a.size == 1 && c.size == 100 && e.size == 300, "BufferArena ranges are not the requested sizes");
+    Check(arena.GetBufferCount() == 1 && arena.GetAllocatedBytes() == 1024, "BufferArena used %u buffers and %ld bytes for one full block",
+          arena.GetBufferCount(), (long)arena.GetAllocatedBytes());
+    unsigned char readBack[100] = {};
+    glGetNamedBufferSubData(c.buffer.GetName(), c.offset, sizeof(readBack), readBack);
+    Check(std::equal(data, data + 100, readBack), "BufferArena did not upload the data of an allocation");
+
+    const mGLu::BufferRange overflow = arena.Allocate(64);
+    Check(arena.GetBufferCount() == 2 && overflow.offset == 0 && overflow.buffer.GetName() != a.buffer.GetName(),
+          "BufferArena did not start a new buffer when the first one was full");
+    const mGLu::BufferRange huge = arena.Allocate(3000);
+    Check(arena.GetBufferCount() == 3 && huge.offset == 0 && huge.size == 3000, "BufferArena did not give an allocation bigger than blockSize a buffer of its own");
+
+    for(const mGLu::BufferRange &range : {b, d, a, e, c}) // out of order, so merges happen both ways
+        arena.Free(range);
+    const mGLu::BufferRange whole = arena.Allocate(1024);
+    Check(whole.buffer.GetName() == a.buffer.GetName() && whole.offset == 0 && arena.GetBufferCount() == 3,
+          "BufferArena did not merge the freed buddies back into a whole block");
+    for(const mGLu::BufferRange &range : {whole, overflow, huge})
+        arena.Free(range);
+    Check(arena.GetAllocatedBytes() == 0, "BufferArena still counts %ld bytes after freeing everything", (long)arena.GetAllocatedBytes());
+
+    std::mt19937 rng(18); // random sizes and frees, no two live ranges may overlap and each starts at a multiple of its block size
+    std::uniform_int_distribution<int> size(1, 1500);
+    std::vector<mGLu::BufferRange> live;
+    for(int step = 0; step < 2000; step++)
+    {
+        if(!live.empty() && rng() % 3 == 0)
+        {
+            const std::size_t victim = rng() % live.size();
+            arena.Free(live[victim]);
+            live.erase(live.begin() + victim);
+            continue;
+        }
+        const mGLu::BufferRange range = arena.Allocate(size(rng));
+        GLsizeiptr blockBytes = 64;
+        while(blockBytes < range.size)
+            blockBytes <<= 1;
+        Check(range.offset % blockBytes == 0 && range.offset + range.size <= range.buffer.GetSize(), "BufferArena placed %ld bytes at %ld",
+              (long)range.size, (long)range.offset);
+        for(const mGLu::BufferRange &other : live)
+            Check(other.buffer.GetName() != range.buffer.GetName() || other.offset + other.size <= range.offset || range.offset + range.size <= other.offset,
+                  "BufferArena handed out overlapping ranges at %ld and %ld", (long)other.offset, (long)range.offset);
+        live.push_back(range);
+    }
+    for(const mGLu::BufferRange &range : live)
+        arena.Free(range);
+    Check(arena.GetAllocatedBytes() == 0, "BufferArena still counts %ld bytes after the random frees", (long)arena.GetAllocatedBytes());
+}
+
+static const char *sortInputCScode = R"DENOM(
+layout(local_size_x = 256) in;
+struct KeyValue
+{
+    float key;
+    uint value;
+};
+layout(std430, binding = 0) readonly buffer KEYS
+{
+    float keys[];
+};
+layout(std430, binding = 1) writeonly buffer KEY_VALUES
+{
+    KeyValue keyValues[];
+};
+layout(location = 0) uniform uint count;
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if(i < count)
+        keyValues[i] = KeyValue(keys[i], i);
+}
+)DENOM";
+// Key counts that are no power of two leave padding the sort has to keep behind the keys, with validate set so Sort()
+// checks itself too. The result has to match std::sort, and every value has to lead back to its key.
+static void TestGPUSorter(const mGLu::Window &window)
+{
+    mGLu::ComputeShader inputShader(window, sortInputCScode);
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> keyDist(-100.f, 100.f);
+    for(bool descending : {false, true})
+    {
+        mGLu::GPUSorter sorter(window, 3000, descending);
+        sorter.validate = true;
+        for(GLuint count : {1, 100, 511, 513, 1000, 3000})
+        {
+            std::vector<float> keys(count);
+            for(float &key : keys)
+                key = std::round(keyDist(rng) * 4.f) / 4.f; // repeats some keys
+            mGLu::FixedBuffer keyBuffer(count, keys.data());
+
+            sorter.Reset();
+            keyBuffer.BindToSSBO(0);
+            sorter.BindKeyValues(1);
+            inputShader.Use();
+            glUniform1ui(0, count);
+            inputShader.Dispatch((count + 255) / 256);
+            sorter.Sort();
+
+            Check(sorter.Validate(), "GPUSorter(%s) failed its own validation of %u keys", descending ? "descending" : "ascending", count);
+            const std::vector<mGLu::GPUSorter::KeyValue> sorted = sorter.ReadBack();
+            std::vector<float> expected = keys;
+            if(descending)
+                std::sort(expected.begin(), expected.end(), std::greater<float>());
+            else
+                std::sort(expected.begin(), expected.end());
+            int wrong = 0;
+            for(GLuint i = 0; i < sorter.GetCapacity(); i++)
+            {
+                if(i >= count)
+                    wrong += sorted[i].value != mGLu::GPUSorter::padValue;
+                else
+                    wrong += sorted[i].key != expected[i] || sorted[i].value >= count || keys[sorted[i].value] != sorted[i].key;
+            }
+            Check(wrong == 0, "GPUSorter(%s) got %d of %u slots wrong sorting %u keys", descending ? "descending" : "ascending", wrong,
+                  sorter.GetCapacity(), count);
+        }
+    }
+}
+
+class TestWindow : public mGLu::Window // the checks that need a GL context run in Start()
+{
+public:
+    using mGLu::Window::Window;
+    void Start() override
+    {
+        TestBufferArena();
+        TestGPUSorter(*this);
+        Close();
+    }
+};
+
+int main()
+{
+    TestBallKernels();
+    TestBallGrid();
+    TestJobSystem();
+    {
+        TestWindow window(64, 64, "tests", false, 4, 3);
+        window.StartMainLoop();
+    }
+    if(failures)
+        std::fprintf(stderr, "%d checks failed\n", failures);
+    else
+        std::puts("All checks passed");
+    return failures;
+}